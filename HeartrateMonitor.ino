@@ -2,13 +2,27 @@
 #define _TIMERINTERRUPT_LOGLEVEL_ 1
 
 #include "ESP8266TimerInterrupt.h"
+#include <LittleFS.h>
+#include <ESP8266WiFi.h>
+#include <ArduinoOTA.h>
 #include "logbuffer.h"
 #include "pulse.h"
+#include "hrhistory.h"
+#include "hrv.h"
+#include "samplering.h"
+#include "samplerate.h"
 
 #define DEBUG
 
 #ifdef DEBUG
 #include "pulse_test.h"
+#include "logbuffer_test.h"
+#include "logparser_test.h"
+#include "hrhistory_test.h"
+#include "samplering_test.h"
+#include "hrv_test.h"
+#include "opcount_test.h"
+#include "samplerate_test.h"
 #endif
 
 // use the least accurate timer interrupt for pulse
@@ -21,36 +35,159 @@
 #define LOG_PULSE_DATA
 #define LOG_HR_DATA
 //#define HR_HUMAN_READABLE
+// keep the tracker across restarts we ask for, like OTA updates (see restart_with_snapshot)
+#define SAVE_PULSE_SNAPSHOTS
+#define PULSE_SNAPSHOT_PATH "/pulse.snap"
+#define PULSE_SNAPSHOT_BYTES 4096
+// take updates over wifi
+//#define OTA_UPDATES
+#define WIFI_SSID ""
+#define WIFI_PASSWORD ""
+// drop the sample rate while the heart rate is steady
+//#define ADAPTIVE_SAMPLING
 
 LogBuffer log_buf(1024);
 
 #define PULSE_TIMER_INTERVAL_MICROSECS (1000000L/PULSE_SAMPLE_RATE)
 ESP8266Timer pulse_timer;
 PulseTracker pulse_tracker;
+HeartRateHistory hr_history;
+HeartRateVariability hrv;
+#ifdef ADAPTIVE_SAMPLING
+SampleRateController rate_controller;
+long last_rate_check = 0;
+#endif
+
+// samples are written once by the timer interrupt, and each consumer reads them at its own pace in loop()
+SampleRing sample_ring(64);
+SampleCursor tracker_cursor(sample_ring);
+#ifdef LOG_PULSE_DATA
+SampleCursor log_cursor(sample_ring);
+#endif
 
 void sample_pulse() {
-  int pulse_signal = analogRead(PULSE_SENSOR_INPUT_PIN);
-  long now = millis();
-  pulse_tracker.push(pulse_signal, now);
+  sample_ring.write(millis(), analogRead(PULSE_SENSOR_INPUT_PIN));
+}
+
+void consume_samples() {
+  Sample s;
+  while (tracker_cursor.read(&s))
+    pulse_tracker.push(s.signal, s.t);
 
   #ifdef LOG_PULSE_DATA
     char line[30];
-    sprintf(
-        line,
-        "p,%d,%d,%d", now, pulse_signal, log_buf.overflow_errs
-    );
-    log_buf.log(line);
+    while (log_cursor.read(&s)) {
+      sprintf(
+          line,
+          "p,%d,%d,%d", s.t, s.signal, log_buf.overflow_errs
+      );
+      log_buf.log(line);
+    }
   #endif
 }
 
+#ifdef SAVE_PULSE_SNAPSHOTS
+// A snapshot is only worth restoring within PULSE_MAX_RESTORE_GAP_MS of being taken. Keeping one
+// that fresh would mean writing ~3KB to flash every few seconds, which wears it out (and it's
+// far too big for the 512 bytes of RTC user memory). So the tracker is only saved right before a
+// restart we ask for, like an OTA update, and the snapshot is deleted once it's been read.
+// Unplanned resets (brownouts, crashes, the watchdog) start the tracker over.
+void save_pulse_snapshot() {
+  std::unique_ptr<char[]> buf(new char[PULSE_SNAPSHOT_BYTES]);
+  int n = pulse_tracker.snapshot(buf.get(), PULSE_SNAPSHOT_BYTES);
+  if (n < 0)
+    return;
+  File f = LittleFS.open(PULSE_SNAPSHOT_PATH, "w");
+  if (!f)
+    return;
+  f.write((uint8_t*)buf.get(), n);
+  f.close();
+}
+
+// use instead of ESP.restart() so that the heart rate picks up where it left off
+void restart_with_snapshot() {
+  consume_samples();
+  save_pulse_snapshot();
+  ESP.restart();
+}
+
+void restore_pulse_snapshot() {
+  if (!LittleFS.exists(PULSE_SNAPSHOT_PATH))
+    return;
+  // a snapshot left behind by a restart that crashed before reading it is too old to use
+  bool fresh = ESP.getResetInfoPtr()->reason == REASON_SOFT_RESTART;
+  std::unique_ptr<char[]> buf(new char[PULSE_SNAPSHOT_BYTES]);
+  int n = 0;
+  File f = LittleFS.open(PULSE_SNAPSHOT_PATH, "r");
+  if (f) {
+    n = f.read((uint8_t*)buf.get(), PULSE_SNAPSHOT_BYTES);
+    f.close();
+  }
+  LittleFS.remove(PULSE_SNAPSHOT_PATH);
+  if (!fresh || n <= 0)
+    return;
+  // The snapshot was taken right before the restart, so the gap is however long we've been
+  // booting. This has to run before anything slow (like the tests) to stay under PULSE_MAX_RESTORE_GAP_MS.
+  long now = millis();
+  int r = pulse_tracker.restore(buf.get(), n, now, now);
+  if (r != PULSE_RESTORE_OK) {
+    Serial.print("Pulse snapshot not restored: ");
+    Serial.println(r);
+  }
+}
+#endif
+
+#ifdef OTA_UPDATES
+bool ota_done = false;
+
+void setup_ota() {
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+  // restart ourselves once the update is written, so the tracker can be saved first
+  ArduinoOTA.setRebootOnSuccess(false);
+  // the upload blocks loop() for a few seconds, so keep the tracker fed through it,
+  // otherwise the snapshot would be too stale to restore
+  ArduinoOTA.onProgress([](unsigned int, unsigned int) { consume_samples(); });
+  ArduinoOTA.onEnd([]() { ota_done = true; });
+  ArduinoOTA.begin();
+}
+
+void handle_ota() {
+  ArduinoOTA.handle();
+  if (!ota_done)
+    return;
+  #ifdef SAVE_PULSE_SNAPSHOTS
+  // a filesystem update has just replaced LittleFS, so there's nowhere to save to
+  if (ArduinoOTA.getCommand() == U_FLASH)
+    restart_with_snapshot();
+  #endif
+  ESP.restart();
+}
+#endif
 
 void setup() {
   pinMode(LED_PIN, OUTPUT);
   Serial.begin(460800);
   Serial.println("\n\n");
+  #ifdef SAVE_PULSE_SNAPSHOTS
+  LittleFS.begin();
+  restore_pulse_snapshot();
+  #endif
 
   #ifdef DEBUG
   all_pulse_tests();
+  all_logbuffer_tests();
+  all_logparser_tests();
+  all_hrhistory_tests();
+  all_samplering_tests();
+  all_hrv_tests();
+  all_opcount_tests();
+  all_samplerate_tests();
+  #endif
+  pulse_tracker.set_history(&hr_history);
+  pulse_tracker.set_hrv(&hrv);
+  #ifdef OTA_UPDATES
+  setup_ota();
   #endif
   /*
   if(!pulse_timer.attachInterruptInterval(PULSE_TIMER_INTERVAL_MICROSECS, sample_pulse)) {
@@ -63,6 +200,19 @@ void setup() {
 long last_hr_time = 0;
 void loop() {
   delay(100);
+  consume_samples();
+  #ifdef OTA_UPDATES
+  handle_ota();
+  #endif
+  #ifdef ADAPTIVE_SAMPLING
+  if (millis()-last_rate_check >= 1000) {
+    last_rate_check = millis();
+    HeartRate hr;
+    pulse_tracker.get_heartrate(&hr);
+    if (rate_controller.update(hr, last_rate_check))
+      pulse_timer.setInterval(rate_controller.interval_us(), sample_pulse);
+  }
+  #endif
   /*
   #ifdef LOG_HR_DATA
     long now = millis();
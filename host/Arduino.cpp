@@ -0,0 +1,55 @@
+#include "Arduino.h"
+#include <chrono>
+#include <thread>
+
+HostSerial Serial;
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t n = 0;
+  while (n < size && write(buffer[n]))
+    n++;
+  return n;
+}
+
+size_t Print::print(const char* s) { return write(s, strlen(s)); }
+size_t Print::print(int v) { return print((long)v); }
+size_t Print::print(long v) {
+  char s[24];
+  return write(s, snprintf(s, sizeof(s), "%ld", v));
+}
+size_t Print::print(unsigned long v) {
+  char s[24];
+  return write(s, snprintf(s, sizeof(s), "%lu", v));
+}
+size_t Print::print(double v) {
+  // Arduino prints 2 decimal places by default
+  char s[32];
+  return write(s, snprintf(s, sizeof(s), "%.2f", v));
+}
+size_t Print::println(const char* s) { return print(s)+write("\n", 1); }
+size_t Print::println(int v) { return print(v)+write("\n", 1); }
+size_t Print::println(long v) { return print(v)+write("\n", 1); }
+size_t Print::println(unsigned long v) { return print(v)+write("\n", 1); }
+size_t Print::println(double v) { return print(v)+write("\n", 1); }
+
+size_t HostSerial::write(uint8_t c) {
+  return fputc(c, stdout) == EOF ? 0 : 1;
+}
+size_t HostSerial::write(const uint8_t* buffer, size_t size) {
+  size_t n = fwrite(buffer, 1, size, stdout);
+  fflush(stdout);
+  return n;
+}
+
+static const std::chrono::steady_clock::time_point boot = std::chrono::steady_clock::now();
+
+unsigned long micros() {
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now()-boot).count();
+}
+unsigned long millis() {
+  return micros()/1000;
+}
+void delay(unsigned long ms) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
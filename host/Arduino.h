@@ -0,0 +1,50 @@
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+// Just enough of the Arduino core to build the tracker, its tests and the host tools on a PC.
+// Serial goes to stdout and never runs out of room.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+using std::abs;
+
+class Print {
+  public:
+    virtual ~Print() = default;
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+    virtual int availableForWrite() { return 0; }
+    size_t print(const char* s);
+    size_t print(int v);
+    size_t print(long v);
+    size_t print(unsigned long v);
+    size_t print(double v);
+    size_t println(const char* s="");
+    size_t println(int v);
+    size_t println(long v);
+    size_t println(unsigned long v);
+    size_t println(double v);
+};
+
+class HostSerial : public Print {
+  public:
+    using Print::write;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    int availableForWrite() override { return 1<<16; }
+};
+
+extern HostSerial Serial;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+inline void yield() {}
+
+#endif
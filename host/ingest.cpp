@@ -0,0 +1,247 @@
+#include "ingest.h"
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::unique_ptr<HrTable> HrTable::create(const char* name) {
+  int fd = shm_open(name, O_CREAT|O_RDWR|O_TRUNC, 0644);
+  if (fd < 0)
+    return nullptr;
+  if (ftruncate(fd, sizeof(Layout)) != 0) {
+    close(fd);
+    shm_unlink(name);
+    return nullptr;
+  }
+  void* mem = mmap(nullptr, sizeof(Layout), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED) {
+    shm_unlink(name);
+    return nullptr;
+  }
+  std::unique_ptr<HrTable> t(new HrTable());
+  t->table = new (mem) Layout();
+  t->table->version = HR_TABLE_VERSION;
+  t->table->n_slots = INGEST_MAX_STREAMS;
+  // the magic goes in last, so an opener never sees a half made table
+  std::atomic_thread_fence(std::memory_order_release);
+  t->table->magic = HR_TABLE_MAGIC;
+  strncpy(t->shm_name, name, INGEST_NAME_LEN-1);
+  t->owner = true;
+  return t;
+}
+
+std::unique_ptr<HrTable> HrTable::open(const char* name) {
+  int fd = shm_open(name, O_RDONLY, 0);
+  if (fd < 0)
+    return nullptr;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size != (off_t)sizeof(Layout)) {
+    close(fd);
+    return nullptr;
+  }
+  void* mem = mmap(nullptr, sizeof(Layout), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mem == MAP_FAILED)
+    return nullptr;
+  Layout* layout = (Layout*)mem;
+  if (layout->magic != HR_TABLE_MAGIC || layout->version != HR_TABLE_VERSION) {
+    munmap(mem, sizeof(Layout));
+    return nullptr;
+  }
+  std::unique_ptr<HrTable> t(new HrTable());
+  t->table = layout;
+  return t;
+}
+
+HrTable::~HrTable() {
+  munmap(table, sizeof(Layout));
+  if (owner)
+    shm_unlink(shm_name);
+}
+
+void HrTable::publish(int slot, const HrTableEntry& entry) {
+  Slot& s = table->slots[slot];
+  unsigned int seq = s.seq.load(std::memory_order_relaxed);
+  s.seq.store(seq+1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  s.entry = entry;
+  s.seq.store(seq+2, std::memory_order_release);
+}
+
+bool HrTable::read(int slot, HrTableEntry* out) const {
+  if (slot < 0 || slot >= table->n_slots)
+    return false;
+  const Slot& s = table->slots[slot];
+  for (int i = 0; i < HR_TABLE_READ_TRIES; i++) {
+    unsigned int before = s.seq.load(std::memory_order_acquire);
+    if (before&1) {
+      // the writer may have been preempted part way through, let it finish
+      std::this_thread::yield();
+      continue;
+    }
+    *out = s.entry;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (s.seq.load(std::memory_order_relaxed) == before)
+      return true;
+  }
+  return false;
+}
+
+void HrTable::abandon(int slot) {
+  Slot& s = table->slots[slot];
+  s.seq.store(s.seq.load(std::memory_order_relaxed)|1, std::memory_order_release);
+}
+
+IngestDaemon::IngestDaemon(HrTable& table, int n_workers) : table(table) {
+  for (int i = 0; i < n_workers; i++) {
+    workers.push_back(std::make_unique<Worker>());
+    Worker& w = *workers.back();
+    w.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    w.wake_fd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    epoll_ctl(w.epoll_fd, EPOLL_CTL_ADD, w.wake_fd, &ev);
+  }
+}
+
+IngestDaemon::~IngestDaemon() {
+  stop();
+  join();
+  for (auto& s : streams) {
+    if (s->open)
+      close(s->fd);
+  }
+  for (auto& w : workers) {
+    close(w->epoll_fd);
+    close(w->wake_fd);
+  }
+}
+
+int IngestDaemon::add_stream(int fd, const char* name) {
+  if (started || streams.size() >= INGEST_MAX_STREAMS || workers.empty())
+    return -1;
+  int slot = streams.size();
+  std::unique_ptr<Stream> s(new Stream());
+  s->fd = fd;
+  s->slot = slot;
+  strncpy(s->name, name, INGEST_NAME_LEN-1);
+  s->name[INGEST_NAME_LEN-1] = 0;
+  // round robin, the streams all run at the same sample rate so they cost about the same
+  Worker& w = *workers[slot%workers.size()];
+  epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.ptr = s.get();
+  if (epoll_ctl(w.epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0)
+    s->pollable = true;
+  else if (errno == EPERM)
+    s->pollable = false;
+  else
+    return -1;
+  w.streams.push_back(s.get());
+  w.n_open++;
+  publish(*s);
+  streams.push_back(std::move(s));
+  return slot;
+}
+
+void IngestDaemon::publish(Stream& s) {
+  HrTableEntry e;
+  memcpy(e.device, s.name, INGEST_NAME_LEN);
+  e.samples = s.parser.samples;
+  e.bad_lines = s.parser.bad_lines;
+  e.open = s.open;
+  s.tracker.get_heartrate(&e.hr);
+  table.publish(s.slot, e);
+}
+
+void IngestDaemon::close_stream(Worker& w, Stream& s) {
+  if (s.pollable)
+    epoll_ctl(w.epoll_fd, EPOLL_CTL_DEL, s.fd, nullptr);
+  close(s.fd);
+  s.open = false;
+  w.n_open--;
+  publish(s);
+}
+
+bool IngestDaemon::drain(Worker& w, Stream& s, char* buf) {
+  long before = s.parser.samples;
+  bool open = true;
+  // epoll is level triggered, so whatever's left after a few reads is picked up on the next
+  // wake up, and one fast stream can't starve the rest
+  for (int r = 0; r < INGEST_READS_PER_WAKE; r++) {
+    ssize_t n = ::read(s.fd, buf, INGEST_READ_BYTES);
+    if (n > 0) {
+      s.parser.feed(buf, n);
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    // EAGAIN is all caught up, anything else (EOF, or EIO from a hung up pty) is closed
+    open = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    break;
+  }
+  if (s.parser.samples != before) {
+    w.samples += s.parser.samples-before;
+    publish(s);
+  }
+  if (!open)
+    close_stream(w, s);
+  return open;
+}
+
+void IngestDaemon::run(Worker& w) {
+  epoll_event events[INGEST_EPOLL_EVENTS];
+  char buf[INGEST_READ_BYTES];
+  while (!stopping && w.n_open > 0) {
+    // regular files never block, so there's no waiting on epoll while any are left
+    bool files = false;
+    for (Stream* s : w.streams)
+      files = files || (s->open && !s->pollable);
+    int n = epoll_wait(w.epoll_fd, events, INGEST_EPOLL_EVENTS, files ? 0 : -1);
+    unsigned long start = micros();
+    for (int i = 0; i < n; i++) {
+      Stream* s = (Stream*)events[i].data.ptr;
+      if (s != nullptr && s->open)
+        drain(w, *s, buf);
+    }
+    for (Stream* s : w.streams) {
+      if (s->open && !s->pollable)
+        drain(w, *s, buf);
+    }
+    w.busy_us += micros()-start;
+  }
+}
+
+void IngestDaemon::start() {
+  if (started)
+    return;
+  started = true;
+  for (auto& w : workers) {
+    Worker* wp = w.get();
+    w->thread = std::thread([this, wp]{ run(*wp); });
+  }
+}
+
+void IngestDaemon::stop() {
+  stopping = true;
+  uint64_t one = 1;
+  for (auto& w : workers) {
+    if (write(w->wake_fd, &one, sizeof(one)) < 0) {
+      // the counter is already non-zero, so it'll wake up anyway
+    }
+  }
+}
+
+void IngestDaemon::join() {
+  for (auto& w : workers) {
+    if (w->thread.joinable())
+      w->thread.join();
+  }
+}
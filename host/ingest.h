@@ -0,0 +1,121 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "logparser.h"
+
+#define INGEST_MAX_STREAMS 256
+#define INGEST_NAME_LEN 32
+#define INGEST_READ_BYTES 4096 // per read(), a serial port rarely has more than this waiting
+#define INGEST_READS_PER_WAKE 4 // reads of a stream before moving on to the others
+#define INGEST_EPOLL_EVENTS 64
+#define HR_TABLE_MAGIC 0x48525442 // "HRTB"
+#define HR_TABLE_VERSION 1
+#define HR_TABLE_READ_TRIES 10000 // a publish is a copy of ~100 bytes, so a slot that stays mid-update this long has lost its writer
+
+// One device's latest heart rate, as seen by readers of an HrTable
+struct HrTableEntry {
+  char device[INGEST_NAME_LEN];
+  long samples; // number of samples parsed from the device so far
+  long bad_lines; // number of its "p," lines that couldn't be parsed
+  bool open; // false once the stream has closed
+  HeartRate hr;
+};
+
+// The latest heart rate of every stream, in POSIX shared memory so that any process can read it
+// without talking to the daemon. Each slot has a single writer (the worker that owns the stream),
+// and is guarded by a sequence lock: the count is odd while the slot is being written, so readers
+// retry until they see the same even count before and after copying it out. A writer that dies
+// part way through leaves the count odd, so readers give up on the slot after HR_TABLE_READ_TRIES.
+class HrTable {
+  private:
+    struct Slot {
+      std::atomic<unsigned int> seq;
+      HrTableEntry entry;
+    };
+    struct Layout {
+      unsigned int magic;
+      int version;
+      int n_slots;
+      Slot slots[INGEST_MAX_STREAMS];
+    };
+    Layout* table = nullptr;
+    char shm_name[INGEST_NAME_LEN] = "";
+    bool owner = false;
+    HrTable() = default;
+  public:
+    // Creates (or replaces) the shared memory table called name (e.g. "/pulsed"),
+    // which is unlinked again when the HrTable is destroyed. nullptr on failure.
+    static std::unique_ptr<HrTable> create(const char* name);
+    // Opens a table another process created, read only. nullptr on failure.
+    static std::unique_ptr<HrTable> open(const char* name);
+    ~HrTable();
+    int slots() const { return table->n_slots; }
+    // only the owner of a slot should publish to it
+    void publish(int slot, const HrTableEntry& entry);
+    // copies out a consistent snapshot of the slot, false if it's out of range
+    // or has been mid-update for too long to be read
+    bool read(int slot, HrTableEntry* out) const;
+    // leaves the slot mid-update, as a writer that died part way through publish() would (for testing)
+    void abandon(int slot);
+};
+
+// Reads many streams of the "p," lines that the device logs (serial ports, ptys, pipes or files),
+// parses them incrementally, and tracks each one's heart rate with its own PulseTracker.
+// The streams are sharded across worker threads, each with its own epoll set, so a stream is only
+// ever touched by one thread and the trackers need no locking. Every read's worth of samples
+// publishes the stream's latest heart rate to the HrTable.
+class IngestDaemon {
+  private:
+    struct Stream {
+      int fd;
+      int slot;
+      bool pollable; // regular files can't be epolled, they're always readable so they're just read until EOF
+      bool open = true;
+      char name[INGEST_NAME_LEN];
+      PulseTracker tracker;
+      PulseLogParser parser;
+      Stream() : parser(tracker) {}
+    };
+    struct Worker {
+      int epoll_fd = -1;
+      int wake_fd = -1; // an eventfd, to interrupt epoll_wait on stop()
+      std::vector<Stream*> streams;
+      int n_open = 0;
+      std::thread thread;
+      std::atomic<long> samples{0};
+      std::atomic<unsigned long> busy_us{0}; // time spent reading and parsing, not waiting
+    };
+    HrTable& table;
+    std::vector<std::unique_ptr<Stream>> streams;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<bool> stopping{false};
+    bool started = false;
+    void run(Worker& w);
+    // reads whatever is waiting on s, returns false once it's closed
+    bool drain(Worker& w, Stream& s, char* buf);
+    void close_stream(Worker& w, Stream& s);
+    void publish(Stream& s);
+  public:
+    IngestDaemon(HrTable& table, int n_workers);
+    ~IngestDaemon();
+    // Adds a stream to read from before start(), which the daemon takes ownership of (and closes).
+    // fd should be non-blocking. Returns the stream's slot in the table, or -1 if it can't be added.
+    int add_stream(int fd, const char* name);
+    // starts the worker threads, which run until stop() or until all of their streams close
+    void start();
+    void stop();
+    // waits for the workers to finish
+    void join();
+    int n_streams() const { return streams.size(); }
+    int n_workers() const { return workers.size(); }
+    // samples parsed so far by worker i, safe to call while running
+    long worker_samples(int i) const { return workers[i]->samples; }
+    // microseconds worker i has spent busy (not waiting on epoll), safe to call while running
+    unsigned long worker_busy_us(int i) const { return workers[i]->busy_us; }
+};
+
+#endif
@@ -0,0 +1,232 @@
+#include "ingest_test.h"
+#include <cstdio>
+#include <cstdlib>
+#include <math.h>
+#include <vector>
+#include <fcntl.h>
+#include <pty.h>
+#include <termios.h>
+#include <unistd.h>
+
+#define ASSERT(t, msg, ...) if(!(t)){char l[128];sprintf(l, msg __VA_OPT__(,) __VA_ARGS__);Serial.println(l);return false;}
+
+#define INGEST_TEST_SHM "/pulse_ingest_test"
+
+// what a device with a finger on the sensor logs: a sharp rise and a slow fall, plus a little noise
+static int device_signal(long t, float bpm, unsigned int* seed) {
+  float phase = t*bpm/60000.0;
+  float p = phase-floor(phase);
+  float v = p < 0.15 ? p/0.15 : exp(-(p-0.15)*4);
+  *seed = *seed*1103515245+12345;
+  return 300+(int)(400*v)+(int)((*seed>>16)%21)-10;
+}
+
+// the lines a device logs between from_ms and to_ms
+static int device_lines(float bpm, long from_ms, long to_ms, unsigned int* seed, char* out) {
+  int len = 0;
+  for (long t = from_ms; t < to_ms; t += 1000/PULSE_SAMPLE_RATE)
+    len += sprintf(&out[len], "p,%ld,%d,0\n", t, device_signal(t, bpm, seed));
+  return len;
+}
+
+// a pty in raw mode, with the slave end non-blocking for the daemon to read like a serial port
+static bool open_pty(int* master, int* slave) {
+  termios tio;
+  if (openpty(master, slave, nullptr, nullptr, nullptr) != 0)
+    return false;
+  tcgetattr(*slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(*slave, TCSANOW, &tio);
+  fcntl(*slave, F_SETFL, fcntl(*slave, F_GETFL)|O_NONBLOCK);
+  return true;
+}
+
+static bool write_all(int fd, const char* buf, int n) {
+  while (n > 0) {
+    ssize_t w = write(fd, buf, n);
+    if (w <= 0)
+      return false;
+    buf += w;
+    n -= w;
+  }
+  return true;
+}
+
+// waits for every slot to have parsed expected samples, false if it takes longer than timeout_ms
+static bool wait_for_samples(const HrTable& table, int n_slots, long expected, long timeout_ms) {
+  unsigned long start = millis();
+  while (millis()-start < (unsigned long)timeout_ms) {
+    bool done = true;
+    for (int i = 0; i < n_slots && done; i++) {
+      HrTableEntry e;
+      done = table.read(i, &e) && e.samples >= expected;
+    }
+    if (done)
+      return true;
+    usleep(1000);
+  }
+  return false;
+}
+
+bool test_pty_streams() {
+  Serial.println("Testing IngestDaemon with ptys and a file...");
+  const float bpms[] = {60, 90, 120, 75};
+  const int n_ptys = 3;
+  const long duration = 40000;
+  const long expected = duration*PULSE_SAMPLE_RATE/1000;
+  std::unique_ptr<HrTable> table = HrTable::create(INGEST_TEST_SHM);
+  ASSERT(table, "Couldn't create the shared memory table");
+  // another process would see the same table
+  std::unique_ptr<HrTable> reader = HrTable::open(INGEST_TEST_SHM);
+  ASSERT(reader, "Couldn't open the shared memory table");
+  std::vector<char> buf(64*duration);
+  unsigned int seed = 5;
+
+  IngestDaemon daemon(*table, 2);
+  int masters[n_ptys];
+  for (int i = 0; i < n_ptys; i++) {
+    int slave;
+    ASSERT(open_pty(&masters[i], &slave), "Couldn't open a pty");
+    char name[INGEST_NAME_LEN];
+    sprintf(name, "pty%d", i);
+    ASSERT(daemon.add_stream(slave, name) == i, "pty %d didn't get slot %d", i, i);
+  }
+  // a recording on disk, which epoll can't wait on
+  char path[] = "/tmp/pulse_ingest_testXXXXXX";
+  int file = mkstemp(path);
+  ASSERT(file >= 0, "Couldn't make a temp file");
+  int len = device_lines(bpms[n_ptys], 0, duration, &seed, buf.data());
+  ASSERT(write_all(file, buf.data(), len), "Couldn't write the temp file");
+  close(file);
+  file = open(path, O_RDONLY|O_NONBLOCK);
+  unlink(path);
+  ASSERT(daemon.add_stream(file, "file") == n_ptys, "The file didn't get slot %d", n_ptys);
+
+  daemon.start();
+  // like the devices, a second of samples at a time, all streams at once
+  for (long t = 0; t < duration; t += 1000) {
+    for (int i = 0; i < n_ptys; i++) {
+      len = device_lines(bpms[i], t, t+1000, &seed, buf.data());
+      ASSERT(write_all(masters[i], buf.data(), len), "Couldn't write to pty %d", i);
+    }
+  }
+  ASSERT(wait_for_samples(*reader, n_ptys+1, expected, 10000), "The daemon didn't keep up");
+  // unplugging the devices closes their streams, which ends the workers
+  for (int i = 0; i < n_ptys; i++)
+    close(masters[i]);
+  daemon.join();
+
+  for (int i = 0; i <= n_ptys; i++) {
+    HrTableEntry e;
+    ASSERT(reader->read(i, &e), "Couldn't read slot %d", i);
+    ASSERT(e.samples == expected, "%s parsed %ld samples and not %ld", e.device, e.samples, expected);
+    ASSERT(e.bad_lines == 0, "%s had %ld bad lines", e.device, e.bad_lines);
+    ASSERT(!e.open, "%s is still open", e.device);
+    ASSERT(e.hr.err[0] == 0, "%s has no heart rate: %s", e.device, e.hr.err);
+    ASSERT(fabs(e.hr.hr-bpms[i])/bpms[i] < 0.03, "%s hr = %.1f and not %.0f", e.device, e.hr.hr, bpms[i]);
+  }
+  return true;
+}
+
+bool test_hr_table() {
+  Serial.println("Testing HrTable...");
+  ASSERT(!HrTable::open(INGEST_TEST_SHM), "Opened a table that doesn't exist");
+  std::unique_ptr<HrTable> table = HrTable::create(INGEST_TEST_SHM);
+  ASSERT(table, "Couldn't create the shared memory table");
+  std::unique_ptr<HrTable> reader = HrTable::open(INGEST_TEST_SHM);
+  ASSERT(reader, "Couldn't open the shared memory table");
+  HrTableEntry e = {};
+  strcpy(e.device, "dev");
+  for (int i = 0; i < 100; i++) {
+    e.samples = i;
+    e.hr.hr = i;
+    table->publish(7, e);
+    HrTableEntry r;
+    ASSERT(reader->read(7, &r), "Couldn't read slot 7");
+    ASSERT(r.samples == i && r.hr.hr == i && strcmp(r.device, "dev") == 0, "Slot 7 is out of date");
+  }
+  HrTableEntry r;
+  ASSERT(!reader->read(INGEST_MAX_STREAMS, &r), "Read past the end of the table");
+  // a writer that died mid-update makes the slot unavailable, rather than hanging the reader
+  table->abandon(7);
+  ASSERT(!reader->read(7, &r), "Read a slot that was left mid-update");
+  ASSERT(reader->read(8, &r), "A slot left mid-update made slot 8 unavailable too");
+  table.reset();
+  ASSERT(!HrTable::open(INGEST_TEST_SHM), "The table wasn't unlinked");
+  return true;
+}
+
+// Many ptys written as fast as the daemon can take them, to see how many devices a core can keep up with
+bool bench_ingest() {
+  Serial.println("Benchmarking IngestDaemon...");
+  const long duration = 60000;
+  const long expected = duration*PULSE_SAMPLE_RATE/1000;
+  int n_workers = std::thread::hardware_concurrency();
+  char l[160];
+  for (int n_streams = 8; n_streams <= 64; n_streams *= 2) {
+    std::unique_ptr<HrTable> table = HrTable::create(INGEST_TEST_SHM);
+    ASSERT(table, "Couldn't create the shared memory table");
+    IngestDaemon daemon(*table, n_workers);
+    std::vector<int> masters(n_streams);
+    for (int i = 0; i < n_streams; i++) {
+      int slave;
+      ASSERT(open_pty(&masters[i], &slave), "Couldn't open pty %d", i);
+      ASSERT(daemon.add_stream(slave, "bench") == i, "Couldn't add pty %d", i);
+    }
+    // the lines are made up front, so the timing is just the daemon (and the pty writes)
+    std::vector<std::vector<char>> lines(n_streams);
+    unsigned int seed = 11;
+    for (int i = 0; i < n_streams; i++) {
+      lines[i].resize(24*expected);
+      lines[i].resize(device_lines(60+i%60, 0, duration, &seed, lines[i].data()));
+    }
+    unsigned long start = micros();
+    daemon.start();
+    const int chunk = 1024;
+    for (size_t off = 0; ; off += chunk) {
+      bool more = false;
+      for (int i = 0; i < n_streams; i++) {
+        if (off >= lines[i].size())
+          continue;
+        int n = lines[i].size()-off < chunk ? lines[i].size()-off : chunk;
+        ASSERT(write_all(masters[i], &lines[i][off], n), "Couldn't write to pty %d", i);
+        more = true;
+      }
+      if (!more)
+        break;
+    }
+    ASSERT(wait_for_samples(*table, n_streams, expected, 60000), "The daemon didn't keep up");
+    unsigned long elapsed = micros()-start;
+    for (int i = 0; i < n_streams; i++)
+      close(masters[i]);
+    daemon.join();
+    unsigned long busy = 0;
+    for (int i = 0; i < n_workers; i++)
+      busy += daemon.worker_busy_us(i);
+    long total = n_streams*expected;
+    float per_core = total*1e6/busy;
+    sprintf(l, "  %2d streams on %d workers: %.0f samples/sec, %.0f samples/sec per busy core (%.0f realtime streams per core)",
+      n_streams, n_workers, total*1e6/elapsed, per_core, per_core/PULSE_SAMPLE_RATE);
+    Serial.println(l);
+  }
+  return true;
+}
+
+bool all_ingest_tests() {
+  Serial.println("Running tests for \"host/ingest.h\\cpp\"...");
+
+  ASSERT(test_hr_table(), "HrTable Failed");
+  ASSERT(test_pty_streams(), "Pty Streams Failed");
+
+  Serial.println("All tests pass!");
+  return true;
+}
+
+bool all_ingest_benchmarks() {
+  Serial.println("Running benchmarks for \"host/ingest.h\\cpp\"...");
+
+  ASSERT(bench_ingest(), "Ingest Benchmark Failed");
+
+  Serial.println("All benchmarks pass!");
+  return true;
+}
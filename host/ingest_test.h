@@ -0,0 +1,10 @@
+#ifndef INGEST_TEST_H
+#define INGEST_TEST_H
+
+#include <Arduino.h>
+#include "ingest.h"
+
+bool all_ingest_tests();
+bool all_ingest_benchmarks();
+
+#endif
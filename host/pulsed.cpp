@@ -0,0 +1,113 @@
+// pulsed: tracks the heart rate of every device given, and keeps the latest of each in a
+// shared memory table (see HrTable) for other processes to read.
+//
+//   g++ -std=gnu++17 -O2 -pthread -Ihost -I. -o pulsed host/pulsed.cpp host/ingest.cpp host/Arduino.cpp
+//     pulse.cpp hrhistory.cpp hrv.cpp logparser.cpp opcount.cpp -lrt
+//   ./pulsed [-w workers] [-s /shm_name] [-i print_interval_secs] /dev/ttyUSB0 /dev/ttyUSB1 recording.log ...
+//
+// Serial ports are put in raw mode at the device's baud rate. Runs until every stream has
+// closed (files end, devices unplug) or it's interrupted.
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include "ingest.h"
+
+#define PULSED_BAUD B460800 // matches Serial.begin() in HeartrateMonitor.ino
+#define PULSED_DEFAULT_SHM "/pulsed"
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void on_signal(int) {
+  interrupted = 1;
+}
+
+static int open_stream(const char* path) {
+  int fd = open(path, O_RDONLY|O_NONBLOCK|O_NOCTTY|O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+  if (isatty(fd)) {
+    termios tio;
+    if (tcgetattr(fd, &tio) == 0) {
+      cfmakeraw(&tio);
+      cfsetispeed(&tio, PULSED_BAUD);
+      cfsetospeed(&tio, PULSED_BAUD);
+      tio.c_cflag |= CLOCAL|CREAD;
+      tcsetattr(fd, TCSANOW, &tio);
+    }
+  }
+  return fd;
+}
+
+static void print_table(const HrTable& table, int n) {
+  for (int i = 0; i < n; i++) {
+    HrTableEntry e;
+    if (!table.read(i, &e))
+      printf("slot %-15d unavailable\n", i);
+    else if (e.hr.err[0] == 0)
+      printf("%-20s %8ld samples  hr %6.1f [%5.1f - %5.1f]%s%s\n", e.device, e.samples, e.hr.hr,
+        e.hr.hr_lb, e.hr.hr_ub, e.hr.provisional ? " provisional" : "", e.open ? "" : " (closed)");
+    else
+      printf("%-20s %8ld samples  %s%s\n", e.device, e.samples, e.hr.err, e.open ? "" : " (closed)");
+  }
+  fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+  int workers = std::thread::hardware_concurrency();
+  const char* shm = PULSED_DEFAULT_SHM;
+  int interval = 5;
+  int opt;
+  while ((opt = getopt(argc, argv, "w:s:i:")) != -1) {
+    switch (opt) {
+      case 'w': workers = atoi(optarg); break;
+      case 's': shm = optarg; break;
+      case 'i': interval = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-w workers] [-s /shm_name] [-i print_interval_secs] device...\n", argv[0]);
+        return 2;
+    }
+  }
+  if (optind == argc || workers < 1) {
+    fprintf(stderr, "usage: %s [-w workers] [-s /shm_name] [-i print_interval_secs] device...\n", argv[0]);
+    return 2;
+  }
+  std::unique_ptr<HrTable> table = HrTable::create(shm);
+  if (!table) {
+    perror("shm_open");
+    return 1;
+  }
+  IngestDaemon daemon(*table, workers);
+  for (int i = optind; i < argc; i++) {
+    int fd = open_stream(argv[i]);
+    if (fd < 0 || daemon.add_stream(fd, argv[i]) < 0) {
+      perror(argv[i]);
+      if (fd >= 0)
+        close(fd);
+      return 1;
+    }
+  }
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+  daemon.start();
+  printf("Tracking %d streams on %d workers, heart rates are in shared memory at %s\n",
+    daemon.n_streams(), daemon.n_workers(), shm);
+  while (!interrupted) {
+    for (int i = 0; i < interval*10 && !interrupted; i++)
+      usleep(100000);
+    print_table(*table, daemon.n_streams());
+    bool open = false;
+    for (int i = 0; i < daemon.n_streams(); i++) {
+      HrTableEntry e;
+      open = open || (table->read(i, &e) && e.open);
+    }
+    if (!open)
+      break;
+  }
+  daemon.stop();
+  daemon.join();
+  return 0;
+}
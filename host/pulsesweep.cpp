@@ -0,0 +1,198 @@
+// pulsesweep: runs a grid of tracker params over a recorded log (see PulseSweep), and prints
+// how well each set tracked a reference heart rate.
+//
+//   g++ -std=gnu++17 -O2 -pthread -DPULSE_SWEEP_THREADS -Ihost -I. -o pulsesweep host/pulsesweep.cpp host/Arduino.cpp
+//     pulse.cpp hrhistory.cpp hrv.cpp logparser.cpp opcount.cpp sweep.cpp
+//   ./pulsesweep [-s slope_ms,...] [-v validation_ms,...] [-z z,...] [-r ratio,...] [-t threads]
+//     [-c reference.csv] recording.log
+//
+// Each list defaults to the one default param, so e.g. "-s 150,200,250 -z -0.5,-1" is a grid of 6.
+// A real recording has no true heart rate per sample, so it's interpolated from a reference:
+// the "hr,<time>,<hr>,<lb>,<ub>,<err>" lines the device logged alongside the samples, or with -c,
+// a CSV of "<time_ms>,<bpm>" lines (e.g. from a chest strap, on the device's clock).
+// Lines of either that don't parse, and logged heart rates with an error, are skipped.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "logparser.h"
+#include "sweep.h"
+
+struct RefPoint {
+  long t;
+  float bpm;
+};
+
+static bool read_file(const char* path, std::vector<char>* out) {
+  FILE* f = fopen(path, "rb");
+  if (f == nullptr)
+    return false;
+  char chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+    out->insert(out->end(), chunk, chunk+n);
+  fclose(f);
+  return true;
+}
+
+// parses a reference line, either a logged "hr," line without an error, or "<time_ms>,<bpm>"
+static bool parse_reference(const char* line, RefPoint* out) {
+  if (strncmp(line, "hr,", 3) == 0) {
+    // the error is whatever follows the fifth comma, and the heart rate is only good without one
+    const char* err = line;
+    for (int commas = 0; commas < 5 && err != nullptr; commas++) {
+      err = strchr(err, ',');
+      if (err != nullptr)
+        err++;
+    }
+    if (err == nullptr || (*err != 0 && *err != '\r'))
+      return false;
+    line += 3;
+  }
+  return sscanf(line, "%ld,%f", &out->t, &out->bpm) == 2 && out->bpm > 0;
+}
+
+// every reference point in bytes, in time order
+static void read_reference(std::vector<char>& bytes, std::vector<RefPoint>* out) {
+  bytes.push_back(0);
+  for (char* line = bytes.data(); line < bytes.data()+bytes.size()-1;) {
+    char* end = strchr(line, '\n');
+    if (end != nullptr)
+      *end = 0;
+    RefPoint p;
+    if (parse_reference(line, &p))
+      out->push_back(p);
+    if (end == nullptr)
+      break;
+    line = end+1;
+  }
+  std::stable_sort(out->begin(), out->end(), [](const RefPoint& a, const RefPoint& b) { return a.t < b.t; });
+}
+
+// the reference at each sample, linear between points and held flat past either end
+static void interpolate(const std::vector<Sample>& samples, const std::vector<RefPoint>& ref, std::vector<float>* out) {
+  out->resize(samples.size());
+  size_t j = 0;
+  for (size_t i = 0; i < samples.size(); i++) {
+    long t = samples[i].t;
+    while (j+1 < ref.size() && ref[j+1].t <= t)
+      j++;
+    if (t <= ref[j].t || j+1 == ref.size()) {
+      (*out)[i] = ref[j].bpm;
+    } else {
+      float f = (float)(t-ref[j].t)/(ref[j+1].t-ref[j].t);
+      (*out)[i] = ref[j].bpm+f*(ref[j+1].bpm-ref[j].bpm);
+    }
+  }
+}
+
+// a comma separated list of numbers, false if any of them isn't one
+template<typename T>
+static bool parse_list(const char* arg, std::vector<T>* out) {
+  out->clear();
+  while (*arg != 0) {
+    char* end;
+    double v = strtod(arg, &end);
+    if (end == arg || (*end != ',' && *end != 0))
+      return false;
+    out->push_back((T)v);
+    arg = *end == ',' ? end+1 : end;
+  }
+  return !out->empty();
+}
+
+static int usage(const char* name) {
+  fprintf(stderr, "usage: %s [-s slope_ms,...] [-v validation_ms,...] [-z z,...] [-r ratio,...] [-t threads] "
+    "[-c reference.csv] recording.log\n", name);
+  return 2;
+}
+
+int main(int argc, char** argv) {
+  PulseParams defaults;
+  std::vector<int> slopes = {defaults.slope_window_ms};
+  std::vector<long> windows = {defaults.validation_window_ms};
+  std::vector<float> zs = {defaults.false_pulse_z};
+  std::vector<float> ratios = {defaults.false_pulse_ratio};
+  int threads = std::thread::hardware_concurrency();
+  const char* ref_path = nullptr;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:v:z:r:t:c:")) != -1) {
+    bool ok = true;
+    switch (opt) {
+      case 's': ok = parse_list(optarg, &slopes); break;
+      case 'v': ok = parse_list(optarg, &windows); break;
+      case 'z': ok = parse_list(optarg, &zs); break;
+      case 'r': ok = parse_list(optarg, &ratios); break;
+      case 't': threads = atoi(optarg); break;
+      case 'c': ref_path = optarg; break;
+      default: ok = false;
+    }
+    if (!ok)
+      return usage(argv[0]);
+  }
+  if (optind+1 != argc || threads < 1)
+    return usage(argv[0]);
+
+  std::vector<char> log;
+  if (!read_file(argv[optind], &log)) {
+    perror(argv[optind]);
+    return 1;
+  }
+  std::vector<Sample> samples;
+  PulseTracker tracker;
+  PulseLogParser parser(tracker);
+  parser.recording = &samples;
+  parser.feed(log.data(), log.size());
+  parser.feed("\n", 1); // in case the log was cut off mid line
+
+  std::vector<RefPoint> ref;
+  if (ref_path != nullptr) {
+    std::vector<char> csv;
+    if (!read_file(ref_path, &csv)) {
+      perror(ref_path);
+      return 1;
+    }
+    read_reference(csv, &ref);
+  } else {
+    read_reference(log, &ref);
+  }
+  printf("%s: %ld samples, %ld bad lines, %d reference heart rates from %s\n", argv[optind], parser.samples,
+    parser.bad_lines, (int)ref.size(), ref_path != nullptr ? ref_path : "the logged hr lines");
+  if (samples.empty() || ref.empty()) {
+    fprintf(stderr, "Need samples and a reference heart rate to score them against\n");
+    return 1;
+  }
+  std::vector<float> true_bpm;
+  interpolate(samples, ref, &true_bpm);
+
+  std::vector<PulseParams> configs;
+  for (int s : slopes) {
+    for (long v : windows) {
+      for (float z : zs) {
+        for (float r : ratios) {
+          PulseParams p;
+          p.slope_window_ms = s;
+          p.validation_window_ms = v;
+          p.false_pulse_z = z;
+          p.false_pulse_ratio = r;
+          configs.push_back(p);
+        }
+      }
+    }
+  }
+  std::vector<SweepResult> results(configs.size());
+  PulseSweep sweep(samples.data(), samples.size(), true_bpm.data());
+  sweep.run(configs.data(), configs.size(), results.data(), threads);
+  // best first, with the ones that never had a heart rate last
+  std::stable_sort(results.begin(), results.end(), [](const SweepResult& a, const SweepResult& b) {
+    if ((a.mean_err < 0) != (b.mean_err < 0))
+      return b.mean_err < 0;
+    return a.mean_err < b.mean_err;
+  });
+  PulseSweep::print(results.data(), results.size());
+  return 0;
+}
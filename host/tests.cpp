@@ -0,0 +1,48 @@
+// Runs every test suite on a PC, along with the benchmarks and the tests that are too big
+// (in time or memory) for the ESP8266 to run at boot.
+//
+//   g++ -std=gnu++17 -O2 -pthread -DPULSE_SWEEP_THREADS -Ihost -I. -o pulse_tests
+//     host/tests.cpp host/ingest_test.cpp host/ingest.cpp host/Arduino.cpp *.cpp -lrt -lutil
+//   ./pulse_tests            tests only
+//   ./pulse_tests -b         tests and benchmarks
+//
+// Add -DPULSE_COST_MODEL for estimates of the ESP8266 cycles per push.
+
+#include <cstring>
+#include "pulse_test.h"
+#include "logbuffer_test.h"
+#include "logparser_test.h"
+#include "hrhistory_test.h"
+#include "samplering_test.h"
+#include "hrv_test.h"
+#include "opcount_test.h"
+#include "sweep_test.h"
+#include "samplerate_test.h"
+#include "ingest_test.h"
+
+int main(int argc, char** argv) {
+  bool benchmarks = argc > 1 && strcmp(argv[1], "-b") == 0;
+  bool ok = true;
+  ok = all_pulse_tests() && ok;
+  ok = all_logbuffer_tests() && ok;
+  ok = all_logparser_tests() && ok;
+  ok = all_hrhistory_tests() && ok;
+  ok = all_samplering_tests() && ok;
+  ok = all_hrv_tests() && ok;
+  ok = all_opcount_tests() && ok;
+  ok = all_sweep_tests() && ok;
+  ok = all_samplerate_tests() && ok;
+  ok = all_ingest_tests() && ok;
+  if (benchmarks) {
+    ok = all_pulse_benchmarks() && ok;
+    ok = all_logparser_benchmarks() && ok;
+    ok = all_hrhistory_benchmarks() && ok;
+    ok = all_samplering_benchmarks() && ok;
+    ok = all_hrv_benchmarks() && ok;
+    ok = all_sweep_benchmarks() && ok;
+    ok = all_samplerate_benchmarks() && ok;
+    ok = all_ingest_benchmarks() && ok;
+  }
+  Serial.println(ok ? "All suites pass!" : "Some suites failed!");
+  return ok ? 0 : 1;
+}
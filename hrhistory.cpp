@@ -0,0 +1,190 @@
+#include "hrhistory.h"
+
+void HeartRateTier::open(long seq) {
+  if (!empty() && seq <= newest_seq())
+    return;
+  long from = empty() ? seq : newest_seq()+1;
+  // after a gap longer than the whole tier, there's nothing worth keeping
+  if (seq-from >= buckets.capacity()) {
+    buckets.clear();
+    mins.clear();
+    maxs.clear();
+    from = seq;
+  }
+  if (empty())
+    first_seq = from;
+  for (long s = from; s <= seq; s++) {
+    if (buckets.full()) {
+      // the oldest bucket is about to be overwritten
+      if (mins.size() > 0 && mins[0] == first_seq)
+        mins.pop_front();
+      if (maxs.size() > 0 && maxs[0] == first_seq)
+        maxs.pop_front();
+      first_seq++;
+    }
+    Bucket& b = buckets.push_back();
+    b.min = UINT16_MAX;
+    b.max = 0;
+    b.count_before = total_count;
+    b.sum_before = total_sum;
+    b.min_up = 0;
+    b.max_up = 0;
+    // an empty bucket only replaces other empty buckets as a candidate
+    while (mins.size() > 0 && at_seq(mins.back()).min >= b.min) {
+      at_seq(mins.back()).min_up = s-mins.back();
+      mins.pop_back();
+    }
+    mins.push_back(s);
+    while (maxs.size() > 0 && at_seq(maxs.back()).max <= b.max) {
+      at_seq(maxs.back()).max_up = s-maxs.back();
+      maxs.pop_back();
+    }
+    maxs.push_back(s);
+  }
+}
+
+void HeartRateTier::add(uint16_t min, uint16_t max, uint32_t count, uint32_t sum) {
+  long seq = newest_seq();
+  Bucket& b = at_seq(seq);
+  total_count += count;
+  total_sum += sum;
+  // the newest bucket is always at the back of the deques, anything it beats is no longer a candidate
+  if (min < b.min) {
+    b.min = min;
+    mins.pop_back();
+    while (mins.size() > 0 && at_seq(mins.back()).min >= min) {
+      at_seq(mins.back()).min_up = seq-mins.back();
+      mins.pop_back();
+    }
+    mins.push_back(seq);
+  }
+  if (max > b.max) {
+    b.max = max;
+    maxs.pop_back();
+    while (maxs.size() > 0 && at_seq(maxs.back()).max <= max) {
+      at_seq(maxs.back()).max_up = seq-maxs.back();
+      maxs.pop_back();
+    }
+    maxs.push_back(seq);
+  }
+}
+
+void HeartRateTier::newest(uint16_t* min, uint16_t* max, uint32_t* count, uint32_t* sum) const {
+  Bucket& b = at_seq(newest_seq());
+  (*min) = b.min;
+  (*max) = b.max;
+  (*count) = total_count-b.count_before;
+  (*sum) = total_sum-b.sum_before;
+}
+
+long HeartRateTier::candidate(long seq, uint8_t Bucket::*up) const {
+  // links only ever point to newer buckets, so the ones dropped off the front are never followed
+  while (at_seq(seq).*up != 0) {
+    Bucket& b = at_seq(seq);
+    long next = seq+b.*up;
+    // skip over the next link from now on (path splitting), it stays within the tier
+    b.*up += at_seq(next).*up;
+    seq = next;
+  }
+  return seq;
+}
+
+void HeartRateTier::suffix(long seq, uint16_t* min, uint16_t* max, uint32_t* count, uint32_t* sum) const {
+  if (seq < first_seq)
+    seq = first_seq;
+  Bucket& b = at_seq(seq);
+  (*count) = total_count-b.count_before;
+  (*sum) = total_sum-b.sum_before;
+  (*min) = at_seq(candidate(seq, &Bucket::min_up)).min;
+  (*max) = at_seq(candidate(seq, &Bucket::max_up)).max;
+}
+
+int HeartRateTier::memory_bytes() const {
+  return buckets.capacity()*(sizeof(Bucket)+2*sizeof(long));
+}
+
+HeartRateHistory::HeartRateHistory() : tiers(new std::unique_ptr<HeartRateTier>[HR_HISTORY_TIERS]) {
+  const long periods[] = HR_HISTORY_PERIODS;
+  const int lengths[] = HR_HISTORY_LENGTHS;
+  for (int i = 0; i < HR_HISTORY_TIERS; i++)
+    tiers[i] = std::make_unique<HeartRateTier>(periods[i], lengths[i]);
+}
+
+void HeartRateHistory::add(long time, float hr) {
+  pfloat scaled = (pfloat)hr*HR_HISTORY_SCALE+0.5f;
+  OPCOUNT(fconv);
+  uint16_t v = scaled < 0 ? 0 : (scaled > UINT16_MAX-1 ? UINT16_MAX-1 : (uint16_t)scaled);
+  add_to(0, time, v, v, 1, v);
+}
+
+void HeartRateHistory::add_to(int k, long t, uint16_t min, uint16_t max, uint32_t count, uint32_t sum) {
+  HeartRateTier& tier = *tiers[k];
+  OPCOUNT(imod);
+  long seq = t/tier.period;
+  // roll the bucket that's closing up into the next tier
+  if (!tier.empty() && seq > tier.newest_seq() && k+1 < HR_HISTORY_TIERS) {
+    uint16_t b_min, b_max;
+    uint32_t b_count, b_sum;
+    tier.newest(&b_min, &b_max, &b_count, &b_sum);
+    if (b_count > 0)
+      add_to(k+1, tier.newest_seq()*tier.period, b_min, b_max, b_count, b_sum);
+  }
+  tier.open(seq);
+  tier.add(min, max, count, sum);
+}
+
+bool HeartRateHistory::summarize(long now, long duration_ms, HeartRateSummary* out) const {
+  int k = 0;
+  while (k+1 < HR_HISTORY_TIERS && tiers[k]->coverage() < duration_ms)
+    k++;
+  uint16_t min = UINT16_MAX;
+  uint16_t max = 0;
+  uint32_t count = 0;
+  uint32_t sum = 0;
+  out->start = now;
+  // the buckets can't be split, so any heart rates after now can't be left out
+  if (!tiers[0]->empty() && now/tiers[0]->period < tiers[0]->newest_seq())
+    return false;
+  HeartRateTier& tier = *tiers[k];
+  long seq = (now-duration_ms)/tier.period;
+  if (!tier.empty() && seq <= tier.newest_seq()) {
+    if (seq < tier.oldest_seq())
+      seq = tier.oldest_seq();
+    tier.suffix(seq, &min, &max, &count, &sum);
+    out->start = seq*tier.period;
+  }
+  // the open buckets of the finer tiers haven't been rolled up yet
+  for (int j = 0; j < k; j++) {
+    if (tiers[j]->empty())
+      continue;
+    uint16_t b_min, b_max;
+    uint32_t b_count, b_sum;
+    tiers[j]->newest(&b_min, &b_max, &b_count, &b_sum);
+    // the newest bucket can be long before the range, after a gap
+    if (b_count == 0 || (tiers[j]->newest_seq()+1)*tiers[j]->period <= now-duration_ms)
+      continue;
+    if (b_min < min)
+      min = b_min;
+    if (b_max > max)
+      max = b_max;
+    count += b_count;
+    sum += b_sum;
+    long b_start = tiers[j]->newest_seq()*tiers[j]->period;
+    if (b_start < out->start)
+      out->start = b_start;
+  }
+  if (count == 0)
+    return false;
+  out->min = (float)min/HR_HISTORY_SCALE;
+  out->max = (float)max/HR_HISTORY_SCALE;
+  out->mean = (float)sum/count/HR_HISTORY_SCALE;
+  out->count = count;
+  return true;
+}
+
+int HeartRateHistory::memory_bytes() const {
+  int bytes = HR_HISTORY_TIERS*(sizeof(std::unique_ptr<HeartRateTier>)+sizeof(HeartRateTier));
+  for (int i = 0; i < HR_HISTORY_TIERS; i++)
+    bytes += tiers[i]->memory_bytes();
+  return bytes;
+}
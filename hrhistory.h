@@ -0,0 +1,101 @@
+#ifndef HRHISTORY_H
+#define HRHISTORY_H
+
+#include <memory>
+#include <stdint.h>
+#include "pulse.h"
+
+#define HR_HISTORY_SCALE 10 // heart rates are stored in 1/10ths of a bpm
+#define HR_HISTORY_TIERS 3
+// bucket period (ms) and number of buckets in each tier (at most 256, see HeartRateTier::Bucket),
+// 1s for the last 2 minutes, 1min for the last hour, and 15min for the last day
+#define HR_HISTORY_PERIODS {1000L, 60000L, 900000L}
+#define HR_HISTORY_LENGTHS {120, 60, 96}
+
+struct HeartRateSummary {
+  long start; // start of the first bucket in the summary, may be before the requested range
+  float min, max, mean;
+  long count; // number of heart rates
+};
+
+// A fixed capacity deque of bucket sequence numbers, used to keep the candidates
+// for the min/max of every suffix of a tier as they're replaced.
+class SeqDeque {
+  private:
+    std::unique_ptr<long[]> buffer;
+    int cap, h = 0, len = 0;
+  public:
+    SeqDeque(int capacity) : buffer(new long[capacity]), cap(capacity) {}
+    int size() const { return len; }
+    long operator[](int i) const { OPCOUNT(imod); return buffer[(h+i)%cap]; }
+    long back() const { OPCOUNT(imod); return buffer[(h+len-1)%cap]; }
+    void push_back(long seq) { OPCOUNT(imod); buffer[(h+len)%cap] = seq; len++; }
+    void pop_back() { len--; }
+    void pop_front() { h = h+1 == cap ? 0 : h+1; len--; }
+    void clear() { h = 0; len = 0; }
+};
+
+// One resolution of the history, a bucket for every period with no gaps, the newest of which is still open.
+// Each bucket keeps the running totals from before it was opened, so the count and
+// sum of any suffix of the tier are a subtraction away. The unsigned totals are
+// allowed to wrap around, the differences still come out exact.
+// The min of a suffix is its oldest min candidate. Each bucket links to a newer bucket with the
+// same suffix min, and a candidate links to the one that replaces it, so following the links
+// (and shortening them on the way) finds it in amortized O(1). Same for the max.
+class HeartRateTier {
+  private:
+    struct Bucket {
+      uint16_t min, max;
+      uint32_t count_before, sum_before;
+      // how many buckets newer the next link is, 0 for a candidate
+      uint8_t min_up, max_up;
+    };
+    RingBuffer<Bucket> buckets;
+    long first_seq = 0; // sequence number (time/period) of buckets[0]
+    uint32_t total_count = 0, total_sum = 0;
+    // seqs of the buckets that are the min/max of some suffix, oldest first
+    SeqDeque mins, maxs;
+    Bucket& at_seq(long seq) const { return buckets[seq-first_seq]; }
+    // seq of the candidate for the suffix from seq, up is &Bucket::min_up or &Bucket::max_up
+    long candidate(long seq, uint8_t Bucket::*up) const;
+  public:
+    const long period;
+    HeartRateTier(long period, int len) : buckets(len), mins(len), maxs(len), period(period) {}
+    bool empty() const { return buckets.size() == 0; }
+    long newest_seq() const { return first_seq+buckets.size()-1; }
+    long oldest_seq() const { return first_seq; }
+    long coverage() const { return period*buckets.capacity(); }
+    // opens buckets up through seq, dropping the oldest ones as needed
+    void open(long seq);
+    // merges into the newest bucket
+    void add(uint16_t min, uint16_t max, uint32_t count, uint32_t sum);
+    // min, max, count & sum of the newest bucket
+    void newest(uint16_t* min, uint16_t* max, uint32_t* count, uint32_t* sum) const;
+    // min, max, count & sum of the buckets from seq to the newest
+    void suffix(long seq, uint16_t* min, uint16_t* max, uint32_t* count, uint32_t* sum) const;
+    // heap bytes used by this tier
+    int memory_bytes() const;
+};
+
+// Fixed memory, multi-resolution history of heart rates.
+// Every heart rate goes into the finest tier, and every bucket that closes rolls up into the next tier.
+// Neither add nor summarize should be interrupted by the other.
+class HeartRateHistory {
+  private:
+    std::unique_ptr<std::unique_ptr<HeartRateTier>[]> tiers;
+    void add_to(int tier, long t, uint16_t min, uint16_t max, uint32_t count, uint32_t sum);
+  public:
+    HeartRateHistory();
+    // amortized O(1), except for filling in buckets after a gap
+    void add(long time, float hr);
+    // Summarizes the heart rates from now-duration_ms to now, at the resolution of the finest tier that
+    // covers it (the range is rounded out to whole buckets). Amortized O(1) per tier.
+    // now is the current time, so it can't be before the newest 1s bucket.
+    // Returns false if there are no heart rates in the range, or now is too early.
+    bool summarize(long now, long duration_ms, HeartRateSummary* out) const;
+    HeartRateTier& tier(int i) const { return *tiers[i]; }
+    // heap bytes used by all the tiers
+    int memory_bytes() const;
+};
+
+#endif
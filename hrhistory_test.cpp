@@ -0,0 +1,131 @@
+#include "hrhistory_test.h"
+#include <cstdio>
+
+#define ASSERT(t, msg, ...) if(!(t)){char l[128];sprintf(l, msg __VA_OPT__(,) __VA_ARGS__);Serial.println(l);return false;}
+
+// a reproducible stream of heart rates, with a 20 minute gap (finger off) after 2 hours
+long hr_time(long i) {
+  long t = i*850+(i%7)*30;
+  return t > 2*3600000L ? t+1200000L : t;
+}
+float hr_value(long i) {
+  return 55+(i*37)%60+0.34;
+}
+uint16_t hr_scaled(long i) {
+  return (uint16_t)(hr_value(i)*HR_HISTORY_SCALE+0.5);
+}
+
+// checks a summary against a brute force pass over every heart rate in [start, now]
+bool check_summary(HeartRateHistory& history, long n, long now, long duration) {
+  HeartRateSummary s;
+  bool found = history.summarize(now, duration, &s);
+  uint16_t min = UINT16_MAX, max = 0;
+  long count = 0;
+  double sum = 0;
+  for (long i = 0; i < n; i++) {
+    long t = hr_time(i);
+    if (t < s.start || t > now)
+      continue;
+    uint16_t v = hr_scaled(i);
+    min = v < min ? v : min;
+    max = v > max ? v : max;
+    count++;
+    sum += v;
+  }
+  ASSERT(found == (count > 0), "summarize(%ld, %ld) found=%d but there are %ld hrs", now, duration, found, count);
+  if (!found)
+    return true;
+  ASSERT(s.start <= now-duration || s.start <= hr_time(0), "Summary starts late: %ld", s.start);
+  ASSERT(s.count == count, "summarize(%ld, %ld).count = %ld and not %ld", now, duration, s.count, count);
+  ASSERT(s.min*HR_HISTORY_SCALE == min, "summarize(%ld, %ld).min = %f and not %f", now, duration, s.min, (float)min/HR_HISTORY_SCALE);
+  ASSERT(s.max*HR_HISTORY_SCALE == max, "summarize(%ld, %ld).max = %f and not %f", now, duration, s.max, (float)max/HR_HISTORY_SCALE);
+  float mean = sum/count/HR_HISTORY_SCALE;
+  ASSERT(abs(s.mean-mean) < 0.01, "summarize(%ld, %ld).mean = %f and not %f", now, duration, s.mean, mean);
+  return true;
+}
+
+bool test_history_summaries() {
+  Serial.println("Testing HeartRateHistory summaries...");
+  HeartRateHistory history;
+  HeartRateSummary s;
+  ASSERT(!history.summarize(0, 60000, &s), "Empty history has a summary");
+  const long durations[] = {5000, 90000, 1800000, 3*3600000L, 20*3600000L};
+  const long checkpoints[] = {30000, 600000, 2*3600000L+600000, 5*3600000L, 26*3600000L};
+  long i = 0;
+  for (long checkpoint : checkpoints) {
+    for (; hr_time(i) <= checkpoint; i++)
+      history.add(hr_time(i), hr_value(i));
+    for (long duration : durations) {
+      if (!check_summary(history, i, checkpoint, duration))
+        return false;
+    }
+  }
+  // in the middle of the finger off gap, the recent tiers should be empty
+  HeartRateHistory gapped;
+  for (i = 0; hr_time(i) < 2*3600000L; i++)
+    gapped.add(hr_time(i), hr_value(i));
+  gapped.add(2*3600000L+1000000, 70);
+  ASSERT(gapped.summarize(2*3600000L+1000000, 60000, &s) && s.count == 1, "Expected only one hr after the gap");
+  return true;
+}
+
+bool test_history_after_gap() {
+  Serial.println("Testing HeartRateHistory summaries long after the last hr...");
+  HeartRateHistory history;
+  HeartRateSummary s;
+  // 30s of hrs, then 10 minutes of nothing
+  for (long t = 0; t < 30000; t += 850)
+    history.add(t, 70);
+  long now = 30000+600000;
+  ASSERT(!history.summarize(now, 60000, &s), "Last minute has an hr from %ld", s.start);
+  // the 1s tier's open bucket is from long before the last 5 minutes
+  ASSERT(!history.summarize(now, 300000, &s), "Last 5 minutes have %ld hrs from %ld", s.count, s.start);
+  ASSERT(history.summarize(now, 620000, &s) && s.count == 36 && s.mean == 70, "Expected all 36 hrs in the last 620s");
+  // a range that ends before the newest hr can't leave it out
+  ASSERT(!history.summarize(10000, 5000, &s), "Summarized a range that ends before the newest hr");
+  return true;
+}
+
+bool bench_history() {
+  Serial.println("Benchmarking HeartRateHistory...");
+  HeartRateHistory history;
+  const long n = 100000; // about a day
+  unsigned long start = micros();
+  for (long i = 0; i < n; i++)
+    history.add(hr_time(i), hr_value(i));
+  unsigned long insert_us = micros()-start;
+  long now = hr_time(n-1);
+  char l[128];
+  sprintf(l, "  %d bytes, insert: %.3fus", history.memory_bytes(), (float)insert_us/n);
+  Serial.println(l);
+  const long durations[] = {60000, 3600000L, 24*3600000L};
+  const int iters = 1000;
+  for (long duration : durations) {
+    HeartRateSummary s;
+    start = micros();
+    for (int i = 0; i < iters; i++)
+      history.summarize(now+i, duration, &s);
+    sprintf(l, "  last %8ldms: %.3fus/query", duration, (float)(micros()-start)/iters);
+    Serial.println(l);
+  }
+  return true;
+}
+
+bool all_hrhistory_tests() {
+  Serial.println("Running tests for \"hrhistory.h\\cpp\"...");
+
+  ASSERT(test_history_summaries(), "History Summaries Failed");
+  ASSERT(test_history_after_gap(), "History After Gap Failed");
+
+  Serial.println("All tests pass!");
+  return true;
+}
+
+bool all_hrhistory_benchmarks() {
+  Serial.println("Running benchmarks for \"hrhistory.h\\cpp\"...");
+
+  ASSERT(bench_history(), "History Benchmark Failed");
+
+  Serial.println("All benchmarks pass!");
+  return true;
+}
@@ -0,0 +1,11 @@
+#ifndef HRHISTORY_TEST_H
+#define HRHISTORY_TEST_H
+
+#include <Arduino.h>
+#include "hrhistory.h"
+
+bool all_hrhistory_tests();
+// too slow to run on the ESP8266 at boot, so only run on a PC (see host/tests.cpp)
+bool all_hrhistory_benchmarks();
+
+#endif
@@ -0,0 +1,98 @@
+#include "hrv.h"
+#include <math.h>
+
+HeartRateVariability::HeartRateVariability(long window_ms, int max_beats)
+  : intervals(new Interval[max_beats]), cap(max_beats), window_ms(window_ms) {}
+
+void HeartRateVariability::pop_front() {
+  Interval& old = at(0);
+  sum -= old.ibi;
+  OPCOUNT(lmul);
+  OPCOUNT(ladd);
+  sum2 -= (uint64_t)old.ibi*old.ibi;
+  if (len > 1 && at(1).follows) {
+    Interval& next = at(1);
+    uint32_t diff = next.ibi > old.ibi ? next.ibi-old.ibi : old.ibi-next.ibi;
+    n_diffs--;
+    OPCOUNT(lmul);
+    OPCOUNT(ladd);
+    sum_diff2 -= (uint64_t)diff*diff;
+    if (diff > HRV_NN50_MS)
+      nn50--;
+    // the interval it followed is gone
+    next.follows = false;
+  }
+  if (++h == cap)
+    h = 0;
+  len--;
+}
+
+void HeartRateVariability::add(long t, long ibi) {
+  if (ibi <= 0 || ibi > UINT16_MAX)
+    return;
+  // expire everything that ended more than the window before this one ends
+  long end = t+ibi;
+  while (len > 0 && at(0).t+at(0).ibi <= end-window_ms)
+    pop_front();
+  if (len == cap)
+    pop_front();
+
+  Interval& in = at(len);
+  in.t = t;
+  in.ibi = ibi;
+  in.follows = false;
+  if (len > 0) {
+    Interval& prev = at(len-1);
+    if (prev.t+prev.ibi == t) {
+      in.follows = true;
+      uint32_t diff = in.ibi > prev.ibi ? in.ibi-prev.ibi : prev.ibi-in.ibi;
+      n_diffs++;
+      OPCOUNT(lmul);
+      OPCOUNT(ladd);
+      sum_diff2 += (uint64_t)diff*diff;
+      if (diff > HRV_NN50_MS)
+        nn50++;
+    }
+  }
+  len++;
+  sum += in.ibi;
+  OPCOUNT(lmul);
+  OPCOUNT(ladd);
+  sum2 += (uint64_t)in.ibi*in.ibi;
+}
+
+void HeartRateVariability::clear() {
+  h = 0;
+  len = 0;
+  sum = 0;
+  sum2 = 0;
+  n_diffs = 0;
+  nn50 = 0;
+  sum_diff2 = 0;
+}
+
+float HeartRateVariability::rmssd() const {
+  if (n_diffs == 0)
+    return -1;
+  // pfloat can't count a conversion from a 64 bit integer by itself
+  OPCOUNT(fconv);
+  return sqrt((pfloat)(float)sum_diff2/n_diffs);
+}
+
+float HeartRateVariability::sdnn() const {
+  if (len < 2)
+    return -1;
+  // n*sum(x^2)-sum(x)^2 is exact in integers, so there's no cancellation to worry about
+  uint64_t n = len;
+  OPCOUNT_N(lmul, 3);
+  OPCOUNT_N(ladd, 2);
+  uint64_t num = n*sum2-(uint64_t)sum*sum;
+  OPCOUNT_N(fconv, 2);
+  return sqrt((pfloat)(float)num/(pfloat)(float)(n*(n-1)));
+}
+
+float HeartRateVariability::pnn50() const {
+  if (n_diffs == 0)
+    return -1;
+  return 100.0f*(pfloat)nn50/n_diffs;
+}
@@ -0,0 +1,60 @@
+#ifndef HRV_H
+#define HRV_H
+
+#include <memory>
+#include <stdint.h>
+#include "pulse.h"
+
+#define HRV_WINDOW_MS 300000L // 5 minutes, the usual window for short term HRV
+#define HRV_MAX_BEATS (HRV_WINDOW_MS*200/60000) // enough intervals to cover the window at 200bpm
+#define HRV_MIN_BEATS 30 // fewer intervals than this aren't published with the heart rate
+#define HRV_NN50_MS 50 // successive intervals differing by more than this count towards pNN50
+
+// Heart rate variability over a sliding time window of inter-beat intervals.
+// Keeps exact integer sums of the intervals, their squares, and the squares of the differences
+// between successive intervals, so every add and expiry is O(1) and nothing ever has to be
+// recomputed over the window.
+class HeartRateVariability {
+  private:
+    struct Interval {
+      long t; // time of the beat that starts the interval
+      uint16_t ibi; // ms to the next beat
+      bool follows; // starts on the beat that ends the interval before it, so they have a successive difference
+    };
+    // oldest first, a deque since intervals expire from the front
+    std::unique_ptr<Interval[]> intervals;
+    const int cap;
+    int h = 0, len = 0;
+    Interval& at(int i) const { OPCOUNT(imod); return intervals[(h+i)%cap]; }
+    const long window_ms;
+    // sums over the intervals in the window
+    uint32_t sum = 0;
+    uint64_t sum2 = 0;
+    // sums over the successive differences in the window
+    uint32_t n_diffs = 0, nn50 = 0;
+    uint64_t sum_diff2 = 0;
+    // drops the oldest interval, and its difference with the one after it
+    void pop_front();
+  public:
+    HeartRateVariability(long window_ms=HRV_WINDOW_MS, int max_beats=HRV_MAX_BEATS);
+    // Adds the interval from a beat at t to the next beat ibi ms later, and drops the intervals
+    // that ended more than the window before this one does. Intervals should be added in order.
+    // Once max_beats are in the window the oldest is dropped, no matter how recent.
+    // O(1) per interval added or dropped.
+    void add(long t, long ibi);
+    void clear();
+    // number of intervals in the window
+    int beats() const { return len; }
+    // number of successive differences in the window
+    int diffs() const { return n_diffs; }
+    // root mean square of the successive differences (ms), -1 if there are none
+    float rmssd() const;
+    // (sample) standard deviation of the intervals (ms), -1 if there are less than 2
+    float sdnn() const;
+    // percent of successive differences that are more than HRV_NN50_MS, -1 if there are none
+    float pnn50() const;
+    // heap bytes used
+    int memory_bytes() const { return cap*sizeof(Interval); }
+};
+
+#endif
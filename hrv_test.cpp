@@ -0,0 +1,171 @@
+#include "hrv_test.h"
+#include <cstdio>
+#include <vector>
+#include <math.h>
+
+#define ASSERT(t, msg, ...) if(!(t)){char l[128];sprintf(l, msg __VA_OPT__(,) __VA_ARGS__);Serial.println(l);return false;}
+
+struct TestInterval {
+  long t, ibi;
+};
+
+// a reproducible stream of intervals, swinging with breathing, with the odd missed beat
+// (a gap, so no successive difference across it) and a minute long gap partway through
+std::vector<TestInterval> hrv_stream(int n) {
+  std::vector<TestInterval> out;
+  unsigned int seed = 17;
+  long t = 0;
+  for (int i = 0; i < n; i++) {
+    seed = seed*1103515245+12345;
+    long ibi = 800+(long)(60*sin(i*2*M_PI/5))+(long)((seed>>16)%41)-20;
+    if (i == n/2)
+      t += 60000;
+    if ((seed>>16)%23 == 0) {
+      // the next beat wasn't valid, skip over it
+      t += ibi;
+      continue;
+    }
+    out.push_back({t, ibi});
+    t += ibi;
+  }
+  return out;
+}
+
+// checks the metrics against a brute force pass over the intervals that should be in the window
+bool check_hrv(HeartRateVariability& hrv, const std::vector<TestInterval>& ins, int last, long window, int max_beats) {
+  long end = ins[last].t+ins[last].ibi;
+  int first = last;
+  while (first > 0 && last-first+1 < max_beats && ins[first-1].t+ins[first-1].ibi > end-window)
+    first--;
+  double sum = 0, sum2 = 0, diff2 = 0;
+  int n = last-first+1, n_diffs = 0, nn50 = 0;
+  for (int i = first; i <= last; i++) {
+    sum += ins[i].ibi;
+    sum2 += ins[i].ibi*ins[i].ibi;
+    if (i > first && ins[i-1].t+ins[i-1].ibi == ins[i].t) {
+      long d = ins[i].ibi-ins[i-1].ibi;
+      diff2 += d*d;
+      n_diffs++;
+      nn50 += abs(d) > HRV_NN50_MS;
+    }
+  }
+  ASSERT(hrv.beats() == n, "beats = %d and not %d after %d", hrv.beats(), n, last);
+  ASSERT(hrv.diffs() == n_diffs, "diffs = %d and not %d after %d", hrv.diffs(), n_diffs, last);
+  if (n_diffs > 0) {
+    float rmssd = sqrt(diff2/n_diffs);
+    float pnn50 = 100.0*nn50/n_diffs;
+    ASSERT(abs(hrv.rmssd()-rmssd) < rmssd*1e-5, "rmssd = %f and not %f after %d", hrv.rmssd(), rmssd, last);
+    ASSERT(abs(hrv.pnn50()-pnn50) < 1e-3, "pnn50 = %f and not %f after %d", hrv.pnn50(), pnn50, last);
+  }
+  if (n > 1) {
+    double mean = sum/n;
+    float sdnn = sqrt((sum2-n*mean*mean)/(n-1));
+    ASSERT(abs(hrv.sdnn()-sdnn) < sdnn*1e-4, "sdnn = %f and not %f after %d", hrv.sdnn(), sdnn, last);
+  }
+  return true;
+}
+
+bool test_hrv_reference() {
+  Serial.println("Testing HRV reference values...");
+  HeartRateVariability hrv;
+  ASSERT(hrv.rmssd() == -1 && hrv.sdnn() == -1 && hrv.pnn50() == -1, "Expected -1 with no intervals");
+  // worked by hand: successive differences 10, -20, 60, -70, mean interval 806
+  const long ibis[] = {800, 810, 790, 850, 780};
+  long t = 1000;
+  for (long ibi : ibis) {
+    hrv.add(t, ibi);
+    t += ibi;
+  }
+  ASSERT(hrv.beats() == 5 && hrv.diffs() == 4, "%d beats and %d diffs", hrv.beats(), hrv.diffs());
+  ASSERT(abs(hrv.rmssd()-sqrt(9000/4.0)) < 1e-3, "rmssd = %f and not 47.434", hrv.rmssd());
+  ASSERT(abs(hrv.sdnn()-sqrt(2920/4.0)) < 1e-3, "sdnn = %f and not 27.019", hrv.sdnn());
+  ASSERT(hrv.pnn50() == 50, "pnn50 = %f and not 50", hrv.pnn50());
+  // a gap means no successive difference
+  hrv.add(t+1000, 900);
+  ASSERT(hrv.beats() == 6 && hrv.diffs() == 4, "Gap counted as a successive difference");
+  hrv.clear();
+  ASSERT(hrv.beats() == 0 && hrv.rmssd() == -1, "Not cleared");
+  return true;
+}
+
+bool test_hrv_window() {
+  Serial.println("Testing HRV sliding window...");
+  // a few minutes, enough to slide the window a couple of times and cross the gap
+  std::vector<TestInterval> ins = hrv_stream(300);
+  const long window = 60000;
+  HeartRateVariability hrv(window, 100);
+  for (int i = 0; i < (int)ins.size(); i++) {
+    hrv.add(ins[i].t, ins[i].ibi);
+    ASSERT(check_hrv(hrv, ins, i, window, 100), "Wrong metrics");
+  }
+  // with fewer beats than fit in the window, the oldest are dropped early
+  HeartRateVariability small(window, 20);
+  for (int i = 0; i < (int)ins.size(); i++) {
+    small.add(ins[i].t, ins[i].ibi);
+    ASSERT(check_hrv(small, ins, i, window, 20), "Wrong metrics when full");
+  }
+  return true;
+}
+
+bool bench_hrv() {
+  Serial.println("Benchmarking incremental HRV vs recomputing the window (us per beat)...");
+  std::vector<TestInterval> ins = hrv_stream(5000);
+  volatile float sink = 0;
+
+  HeartRateVariability hrv;
+  unsigned long start = micros();
+  for (const TestInterval& in : ins) {
+    hrv.add(in.t, in.ibi);
+    sink = sink+hrv.rmssd()+hrv.sdnn()+hrv.pnn50();
+  }
+  unsigned long incremental = micros()-start;
+
+  // what it'd take to recompute the 5 minute window after each beat
+  start = micros();
+  int first = 0;
+  for (int last = 0; last < (int)ins.size(); last++) {
+    long end = ins[last].t+ins[last].ibi;
+    while (ins[first].t+ins[first].ibi <= end-HRV_WINDOW_MS)
+      first++;
+    long long sum = 0, sum2 = 0, diff2 = 0;
+    int n_diffs = 0, nn50 = 0;
+    for (int i = first; i <= last; i++) {
+      sum += ins[i].ibi;
+      sum2 += ins[i].ibi*ins[i].ibi;
+      if (i > first && ins[i-1].t+ins[i-1].ibi == ins[i].t) {
+        long d = ins[i].ibi-ins[i-1].ibi;
+        diff2 += d*d;
+        n_diffs++;
+        nn50 += abs(d) > HRV_NN50_MS;
+      }
+    }
+    int n = last-first+1;
+    sink = sink+sqrt((float)diff2/n_diffs)+sqrt((float)(n*sum2-sum*sum)/(n*(n-1)))+100.0*nn50/n_diffs;
+  }
+  unsigned long recompute = micros()-start;
+
+  char l[128];
+  sprintf(l, "  incremental: %7.3f  recompute: %7.3f  (%d intervals, %d bytes)",
+    (float)incremental/ins.size(), (float)recompute/ins.size(), hrv.beats(), hrv.memory_bytes());
+  Serial.println(l);
+  return true;
+}
+
+bool all_hrv_tests() {
+  Serial.println("Running tests for \"hrv.h\\cpp\"...");
+
+  ASSERT(test_hrv_reference(), "HRV Reference Values Failed");
+  ASSERT(test_hrv_window(), "HRV Sliding Window Failed");
+
+  Serial.println("All tests pass!");
+  return true;
+}
+
+bool all_hrv_benchmarks() {
+  Serial.println("Running benchmarks for \"hrv.h\\cpp\"...");
+
+  ASSERT(bench_hrv(), "HRV Benchmark Failed");
+
+  Serial.println("All benchmarks pass!");
+  return true;
+}
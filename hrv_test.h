@@ -0,0 +1,11 @@
+#ifndef HRV_TEST_H
+#define HRV_TEST_H
+
+#include <Arduino.h>
+#include "hrv.h"
+
+bool all_hrv_tests();
+// too slow to run on the ESP8266 at boot, so only run on a PC (see host/tests.cpp)
+bool all_hrv_benchmarks();
+
+#endif
@@ -2,6 +2,10 @@
 
 #include "Arduino.h"
 
+int LogBuffer::fill() const {
+  return (buffer_len+write_head-read_head-1)%buffer_len;
+}
+
 int LogBuffer::log(char* str) {
   int i = 0;
   int bi;
@@ -10,6 +14,7 @@ int LogBuffer::log(char* str) {
     if (bi == read_head) {
       // can't catch up to the read head
       overflow_errs++;
+      dropped_bytes += strlen(str)+1;
       return -1;
     }
     buffer[bi] = str[i];
@@ -21,26 +26,57 @@ int LogBuffer::log(char* str) {
   if (bi == read_head) {
     // can't catch up to the read head
     overflow_errs++;
+    dropped_bytes += i+1;
     return -1;
   }
   buffer[bi] = '\n';
   i++;
 
   write_head = (write_head+i)%buffer_len;
+  int f = fill();
+  if (f > high_water)
+    high_water = f;
   return 0;
 }
 
-void LogBuffer::flush_to_serial() {
+int LogBuffer::flush(Print& out, int budget) {
   ATOMIC_INT cur_write_head = write_head;
-  int read_start = (read_head+1)%buffer_len;
-  // if the write head has wrapped around, but the read head hasn't yet
-  if (cur_write_head < read_head && read_start != 0) {
-    // flush to the end of the buffer
-    Serial.write(&buffer[read_start], buffer_len-read_start);
-    read_start = 0;
+  // write_head only moves past whole lines, so everything pending ends in a '\n'
+  int pending = (buffer_len+cur_write_head-read_head-1)%buffer_len;
+  if (pending == 0)
+    return 0;
+  int avail = out.availableForWrite();
+  if (budget < 0 || budget > avail)
+    budget = avail;
+  int n = pending;
+  if (budget < pending) {
+    deferred_flushes++;
+    // back off to the end of the last whole line that fits in the budget
+    n = budget;
+    while(n > 0 && buffer[(read_head+n)%buffer_len] != '\n')
+      n--;
+    if (n == 0) {
+      // the first line alone is over budget, so it has to be split
+      if (budget == 0)
+        return 0;
+      n = budget;
+      if (!mid_line)
+        split_lines++;
+    }
   }
-  // flush to catch up with write_head
-  if (cur_write_head != 0)
-    Serial.write(&buffer[read_start], cur_write_head-read_start);
-  read_head = (buffer_len+cur_write_head-1)%buffer_len;
-}
\ No newline at end of file
+  mid_line = buffer[(read_head+n)%buffer_len] != '\n';
+  int read_start = (read_head+1)%buffer_len;
+  int first = buffer_len-read_start;
+  if (first > n)
+    first = n;
+  out.write(&buffer[read_start], first);
+  // the rest wrapped around to the start of the buffer
+  if (first < n)
+    out.write(&buffer[0], n-first);
+  read_head = (read_head+n)%buffer_len;
+  return n;
+}
+
+int LogBuffer::flush_to_serial(int budget) {
+  return flush(Serial, budget);
+}
@@ -3,6 +3,8 @@
 
 #include <memory>
 
+class Print;
+
 // Assumes this to be the integer type for which setting
 // and getting is an atomic operation. Depends on the underlying architecture,
 // but since I'm only using esp8266, and it's 32 bit, int is fine.
@@ -15,6 +17,8 @@ class LogBuffer {
     ATOMIC_INT read_head;
     ATOMIC_INT buffer_len;
     std::unique_ptr<char[]> buffer;
+    // whether the last flush stopped part way through a line
+    bool mid_line = false;
   public:
     LogBuffer(ATOMIC_INT length) : buffer(new char[length]) {
       buffer_len = length;
@@ -24,14 +28,33 @@ class LogBuffer {
       read_head = 0;
     }
     ~LogBuffer() = default;
-    // a count of the number of overflow errors
+    // a count of the number of overflow errors (i.e. dropped log lines)
     int overflow_errs = 0;
+    // number of bytes (including '\n's) in the dropped log lines
+    int dropped_bytes = 0;
+    // the most bytes that have ever been waiting in the buffer
+    int high_water = 0;
+    // number of flushes that couldn't empty the buffer because of the budget
+    int deferred_flushes = 0;
+    // number of lines too long for a flush's budget, that were written over several flushes
+    int split_lines = 0;
+    // number of bytes currently waiting to be flushed
+    int fill() const;
+    int capacity() const { return buffer_len-1; }
     // fast, but should not be interrupted
     // returns 0 on success, -1 on buffer overflow error
     int log(char* str);
     // slow, but fine to be interrupted
+    // Writes whole log lines to out, but never more than budget bytes or
+    // out.availableForWrite() bytes, so it never blocks. A negative budget means
+    // only out.availableForWrite() limits the flush. Lines that don't fit are left
+    // in the buffer for the next call, so log lines aren't split, unless the first
+    // line alone is longer than the budget. Then as much of it as fits is written,
+    // and the rest goes out with the next call, so a long line can't stall the buffer.
+    // Returns the number of bytes written.
+    int flush(Print& out, int budget = -1);
     // should be called within loop or ticker to periodically dump the log lines in
     // the buffer to Serial, otherwise no logs will be printed and the buffer will overflow.
-    void flush_to_serial();
+    int flush_to_serial(int budget = -1);
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,130 @@
+#include "logbuffer_test.h"
+#include <cstdio>
+#include <string>
+
+#define ASSERT(t, msg, ...) if(!(t)){char l[128];sprintf(l, msg __VA_OPT__(,) __VA_ARGS__);Serial.println(l);return false;}
+
+// A stand-in for Serial that only accepts `bandwidth` bytes between calls to tick(),
+// like a UART tx fifo draining at a fixed baud rate.
+class MockSerial : public Print {
+  public:
+    std::string out;
+    int bandwidth;
+    int room;
+    int largest_write = 0;
+    MockSerial(int bandwidth) : bandwidth(bandwidth), room(bandwidth) {}
+    void tick() { room = bandwidth; }
+    size_t write(uint8_t c) override {
+      if (room <= 0)
+        return 0;
+      out.push_back(c);
+      room--;
+      return 1;
+    }
+    size_t write(const uint8_t* b, size_t n) override {
+      size_t i = 0;
+      while(i < n && write(b[i]))
+        i++;
+      if ((int)i > largest_write)
+        largest_write = i;
+      return i;
+    }
+    int availableForWrite() override { return room; }
+};
+
+bool test_overflow_accounting() {
+  Serial.println("Testing LogBuffer overflow accounting...");
+  LogBuffer buf(16);
+  char line[] = "abcdef";
+  ASSERT(buf.log(line) == 0, "First line dropped");
+  ASSERT(buf.log(line) == 0, "Second line dropped");
+  ASSERT(buf.fill() == 14, "fill() = %d and not 14", buf.fill());
+  ASSERT(buf.log(line) == -1, "Third line should overflow");
+  ASSERT(buf.overflow_errs == 1, "overflow_errs = %d and not 1", buf.overflow_errs);
+  ASSERT(buf.dropped_bytes == 7, "dropped_bytes = %d and not 7", buf.dropped_bytes);
+  ASSERT(buf.high_water == 14, "high_water = %d and not 14", buf.high_water);
+  return true;
+}
+
+bool test_budgeted_flush() {
+  Serial.println("Testing LogBuffer budgeted flush...");
+  LogBuffer buf(64);
+  MockSerial sink(16);
+  std::string expected;
+  char line[30];
+  // log faster than the sink can drain, wrapping the buffer around a few times
+  for (int tick = 0; tick < 200; tick++) {
+    for (int i = 0; tick < 100 && i < 2; i++) {
+      sprintf(line, "p,%d,%d", tick*25+i, tick%7 == 0 ? 1023 : tick);
+      if (buf.log(line) == 0) {
+        expected += line;
+        expected += '\n';
+      }
+    }
+    sink.tick();
+    int n = buf.flush(sink);
+    ASSERT(n <= sink.bandwidth, "Flushed %d bytes with only %d available", n, sink.bandwidth);
+    ASSERT(sink.out.empty() || sink.out.back() == '\n', "Flush split a log line at tick %d", tick);
+  }
+  ASSERT(buf.fill() == 0, "Buffer didn't drain, fill() = %d", buf.fill());
+  ASSERT(sink.out == expected, "Flushed output doesn't match the logged lines");
+  ASSERT(sink.largest_write <= sink.bandwidth, "A single write was %d bytes", sink.largest_write);
+  ASSERT(buf.deferred_flushes > 0, "Expected the slow sink to defer some flushes");
+  ASSERT(buf.overflow_errs > 0, "Expected the slow sink to cause some dropped lines");
+  ASSERT(buf.high_water <= buf.capacity(), "high_water %d > capacity", buf.high_water);
+
+  // an explicit budget smaller than availableForWrite should be respected too
+  sprintf(line, "0123456789");
+  buf.log(line);
+  buf.log(line);
+  sink.out.clear();
+  sink.bandwidth = 1000;
+  sink.tick();
+  int n = buf.flush(sink, 15);
+  ASSERT(n == 11, "Budgeted flush wrote %d bytes and not 11", n);
+  n = buf.flush(sink);
+  ASSERT(n == 11 && buf.fill() == 0, "Unbudgeted flush wrote %d bytes and not 11", n);
+  return true;
+}
+
+bool test_long_line_flush() {
+  Serial.println("Testing LogBuffer flush of a line longer than the budget...");
+  LogBuffer buf(64);
+  MockSerial sink(8);
+  char long_line[] = "hr,123456,72.50,71.00,74.00,";
+  char short_line[] = "p,1,2";
+  buf.log(long_line);
+  buf.log(short_line);
+  std::string expected = std::string(long_line)+"\n"+short_line+"\n";
+  // the long line goes out a budget at a time, then the short one whole
+  for (int i = 0; i < 10 && buf.fill() > 0; i++) {
+    sink.tick();
+    int n = buf.flush(sink);
+    ASSERT(n > 0, "Flush %d wrote nothing with %d bytes pending", i, buf.fill());
+  }
+  ASSERT(buf.fill() == 0, "Buffer didn't drain, fill() = %d", buf.fill());
+  ASSERT(sink.out == expected, "Flushed output doesn't match the logged lines");
+  ASSERT(buf.split_lines == 1, "split_lines = %d and not 1", buf.split_lines);
+  ASSERT(sink.largest_write <= sink.bandwidth, "A single write was %d bytes", sink.largest_write);
+  // an explicit budget too small for the next line splits it too
+  buf.log(short_line);
+  sink.bandwidth = 1000;
+  sink.tick();
+  int n = buf.flush(sink, 4);
+  ASSERT(n == 4, "Budgeted flush wrote %d bytes of a long line and not 4", n);
+  n = buf.flush(sink, 4);
+  ASSERT(n == 2 && buf.fill() == 0, "Flushed %d bytes of the rest of the line and not 2", n);
+  ASSERT(buf.split_lines == 2, "split_lines = %d and not 2", buf.split_lines);
+  return true;
+}
+
+bool all_logbuffer_tests() {
+  Serial.println("Running tests for \"logbuffer.h\\cpp\"...");
+
+  ASSERT(test_overflow_accounting(), "Overflow Accounting Failed");
+  ASSERT(test_budgeted_flush(), "Budgeted Flush Failed");
+  ASSERT(test_long_line_flush(), "Long Line Flush Failed");
+
+  Serial.println("All tests pass!");
+  return true;
+}
@@ -0,0 +1,9 @@
+#ifndef LOGBUFFER_TEST_H
+#define LOGBUFFER_TEST_H
+
+#include <Arduino.h>
+#include "logbuffer.h"
+
+bool all_logbuffer_tests();
+
+#endif
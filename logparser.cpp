@@ -0,0 +1,95 @@
+#include "logparser.h"
+#include <climits>
+
+void PulseLogParser::feed(const char* bytes, int n) {
+  for (int i = 0; i < n; i++) {
+    char c = bytes[i];
+    switch(state) {
+      case LINE_START:
+        if (c == 'p') {
+          state = TAG;
+        } else if (c != '\n' && c != '\r') {
+          state = SKIP;
+          skipped_lines++;
+        }
+        break;
+      case TAG:
+        if (c == ',') {
+          state = FIELD;
+          field = 0;
+          value = 0;
+          negative = false;
+          digits = 0;
+        } else if (c == '\n') {
+          skipped_lines++;
+          state = LINE_START;
+        } else {
+          // some other line that happens to start with a 'p'
+          skipped_lines++;
+          state = SKIP;
+        }
+        break;
+      case FIELD:
+        if (c >= '0' && c <= '9') {
+          if (digits == LOG_PARSER_MAX_DIGITS) {
+            // no time or signal is ever this long, and it could overflow
+            bad_line();
+            break;
+          }
+          value = value*10+(c-'0');
+          digits++;
+        } else if (c == '-' && digits == 0 && !negative) {
+          negative = true;
+        } else if (c == ',') {
+          if (!end_field())
+            bad_line();
+        } else if (c == '\n' || c == '\r') {
+          if (end_field())
+            end_line();
+          else
+            bad_line();
+          // a '\r' leaves the '\n' to be eaten at LINE_START
+          if (c == '\n' || state != SKIP)
+            state = LINE_START;
+        } else {
+          bad_line();
+        }
+        break;
+      case SKIP:
+        if (c == '\n')
+          state = LINE_START;
+        break;
+    }
+  }
+}
+
+bool PulseLogParser::end_field() {
+  if (digits == 0 || field >= LOG_PARSER_MAX_FIELDS || value > LONG_MAX)
+    return false;
+  fields[field] = negative ? -value : value;
+  field++;
+  value = 0;
+  negative = false;
+  digits = 0;
+  return true;
+}
+
+void PulseLogParser::end_line() {
+  // need at least the time and the signal
+  if (field < 2) {
+    bad_line();
+    return;
+  }
+  last_time = fields[0];
+  if (field > 2)
+    device_overflow_errs = fields[2];
+  tracker.push(fields[1], fields[0]);
+  if (recording != nullptr)
+    recording->push_back({fields[0], (int)fields[1]});
+  samples++;
+}
+
+void PulseLogParser::bad_line() {
+  bad_lines++;
+  state = SKIP;
+}
@@ -0,0 +1,52 @@
+#ifndef LOGPARSER_H
+#define LOGPARSER_H
+
+#include <vector>
+#include "pulse.h"
+#include "samplering.h"
+
+#define LOG_PARSER_MAX_FIELDS 3
+#define LOG_PARSER_MAX_DIGITS 10 // enough for any 32 bit millis(), longer numbers are rejected before they can overflow
+
+// Incrementally parses the "p,<time>,<signal>,<overflow_errs>" lines written by
+// sample_pulse() and pushes each sample into a PulseTracker.
+// Bytes can be fed in arbitrarily sized chunks (e.g. whatever a read() on a
+// serial port returns), lines split across chunks are stitched back together,
+// and nothing is allocated or copied per line. Any other lines (test output,
+// "hr," lines, garbage from a reset) are skipped.
+// One parser per input stream, each with its own tracker.
+class PulseLogParser {
+  private:
+    enum State { LINE_START, TAG, FIELD, SKIP };
+    PulseTracker& tracker;
+    State state = LINE_START;
+    long fields[LOG_PARSER_MAX_FIELDS];
+    int field = 0;
+    long long value = 0; // room for LOG_PARSER_MAX_DIGITS digits, checked against long when the field ends
+    bool negative = false;
+    int digits = 0; // in the current field
+    bool end_field();
+    void end_line();
+    void bad_line();
+  public:
+    PulseLogParser(PulseTracker& tracker) : tracker(tracker) {}
+    // number of samples pushed into the tracker
+    long samples = 0;
+    // number of "p," lines that couldn't be parsed
+    long bad_lines = 0;
+    // number of non-"p," lines that were skipped
+    long skipped_lines = 0;
+    // the time of the last sample, or -1 if there haven't been any
+    long last_time = -1;
+    // the overflow_errs count of the device's LogBuffer as of the last sample
+    long device_overflow_errs = 0;
+    // if set, every parsed sample is also appended to this, e.g. to replay through a PulseSweep
+    std::vector<Sample>* recording = nullptr;
+    // Parses n bytes, pushing every completed sample line into the tracker.
+    // Not safe to be interrupted by another feed() on the same parser.
+    void feed(const char* bytes, int n);
+    // the tracker this parser is feeding
+    PulseTracker& get_tracker() { return tracker; }
+};
+
+#endif
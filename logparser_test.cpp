@@ -0,0 +1,108 @@
+#include "logparser_test.h"
+#include <cstdio>
+#include <cstring>
+#include <math.h>
+#include <memory>
+#include <vector>
+
+#define ASSERT(t, msg, ...) if(!(t)){char l[128];sprintf(l, msg __VA_OPT__(,) __VA_ARGS__);Serial.println(l);return false;}
+
+bool test_parse_lines() {
+  Serial.println("Testing PulseLogParser lines...");
+  PulseTracker tracker;
+  PulseLogParser parser(tracker);
+  const char* input =
+    "\n\n\nRunning tests for \"pulse.h\\cpp\"...\n"
+    "p,0,512,0\n"
+    "p,25,-3,0\r\n"
+    "hr,1000,60.0,55.0,65.0,\n"
+    "p,50,abc,0\n"
+    "p,75,600,2\n"
+    "p,100\n"
+    "p,125,601,2,7\n"
+    "pp,150,1,0\n"
+    "p,175,99999999999999999999999,0\n";
+  parser.feed(input, strlen(input));
+  ASSERT(parser.samples == 3, "samples = %ld and not 3", parser.samples);
+  ASSERT(parser.bad_lines == 4, "bad_lines = %ld and not 4", parser.bad_lines);
+  ASSERT(parser.skipped_lines == 3, "skipped_lines = %ld and not 3", parser.skipped_lines);
+  ASSERT(parser.last_time == 75, "last_time = %ld and not 75", parser.last_time);
+  ASSERT(parser.device_overflow_errs == 2, "device_overflow_errs = %ld and not 2", parser.device_overflow_errs);
+  return true;
+}
+
+bool test_parse_chunks() {
+  Serial.println("Testing PulseLogParser chunking...");
+  PulseTracker tracker;
+  PulseLogParser parser(tracker);
+  char line[30];
+  long expected_sum = 0;
+  // feed one byte at a time, so every line is split across calls
+  for (int i = 0; i < 100; i++) {
+    sprintf(line, "p,%d,%d,0\n", i*25, i);
+    for (int j = 0; line[j] != 0; j++)
+      parser.feed(&line[j], 1);
+    expected_sum += i;
+  }
+  ASSERT(parser.samples == 100, "samples = %ld and not 100", parser.samples);
+  ASSERT(parser.bad_lines == 0, "bad_lines = %ld and not 0", parser.bad_lines);
+  ASSERT(parser.last_time == 99*25, "last_time = %ld and not %d", parser.last_time, 99*25);
+  return true;
+}
+
+bool all_logparser_tests() {
+  Serial.println("Running tests for \"logparser.h\\cpp\"...");
+
+  ASSERT(test_parse_lines(), "Parsing Lines Failed");
+  ASSERT(test_parse_chunks(), "Parsing Chunks Failed");
+
+  Serial.println("All tests pass!");
+  return true;
+}
+
+// many independent streams, each with their own tracker, fed round robin in serial read sized chunks
+bool bench_log_parser() {
+  Serial.println("Benchmarking PulseLogParser...");
+  const int n_streams = 4;
+  const int n_samples = 4000;
+  const int lines_per_chunk = 8;
+  std::vector<std::unique_ptr<PulseTracker>> trackers;
+  std::vector<std::unique_ptr<PulseLogParser>> parsers;
+  for (int s = 0; s < n_streams; s++) {
+    trackers.push_back(std::make_unique<PulseTracker>());
+    parsers.push_back(std::make_unique<PulseLogParser>(*trackers.back()));
+  }
+  char chunk[30*lines_per_chunk];
+  unsigned long elapsed = 0;
+  for (int i = 0; i < n_samples; i += lines_per_chunk) {
+    // a ~72bpm synthetic pulse
+    int len = 0;
+    for (int j = i; j < i+lines_per_chunk; j++) {
+      long t = j*1000L/PULSE_SAMPLE_RATE;
+      int signal = 512+(int)(200*sin(2*M_PI*t/833.0));
+      len += sprintf(&chunk[len], "p,%ld,%d,0\n", t, signal);
+    }
+    unsigned long start = micros();
+    for (auto& p : parsers)
+      p->feed(chunk, len);
+    elapsed += micros()-start;
+  }
+  long total = 0;
+  for (auto& p : parsers)
+    total += p->samples;
+  ASSERT(total == (long)n_streams*n_samples, "Only parsed %ld samples", total);
+  char l[128];
+  sprintf(l, "  %d streams, %ld samples in %luus: %.0f samples/sec, %.1f realtime streams per core",
+    n_streams, total, elapsed, total*1e6/elapsed, total*1e6/elapsed/PULSE_SAMPLE_RATE);
+  Serial.println(l);
+  return true;
+}
+
+bool all_logparser_benchmarks() {
+  Serial.println("Running benchmarks for \"logparser.h\\cpp\"...");
+
+  ASSERT(bench_log_parser(), "Parser Benchmark Failed");
+
+  Serial.println("All benchmarks pass!");
+  return true;
+}
@@ -0,0 +1,11 @@
+#ifndef LOGPARSER_TEST_H
+#define LOGPARSER_TEST_H
+
+#include <Arduino.h>
+#include "logparser.h"
+
+bool all_logparser_tests();
+// too slow to run on the ESP8266 at boot, so only run on a PC (see host/tests.cpp)
+bool all_logparser_benchmarks();
+
+#endif
@@ -0,0 +1,53 @@
+#include "opcount.h"
+
+OpCounts OpCounts::operator-(const OpCounts& o) const {
+  OpCounts r;
+  r.fadd = fadd-o.fadd;
+  r.fmul = fmul-o.fmul;
+  r.fdiv = fdiv-o.fdiv;
+  r.fcmp = fcmp-o.fcmp;
+  r.fconv = fconv-o.fconv;
+  r.fsqrt = fsqrt-o.fsqrt;
+  r.imod = imod-o.imod;
+  r.ladd = ladd-o.ladd;
+  r.lmul = lmul-o.lmul;
+  return r;
+}
+
+OpCounts& OpCounts::operator+=(const OpCounts& o) {
+  fadd += o.fadd;
+  fmul += o.fmul;
+  fdiv += o.fdiv;
+  fcmp += o.fcmp;
+  fconv += o.fconv;
+  fsqrt += o.fsqrt;
+  imod += o.imod;
+  ladd += o.ladd;
+  lmul += o.lmul;
+  return *this;
+}
+
+float CycleTable::cycles(const OpCounts& ops) const {
+  return ops.fadd*fadd+ops.fmul*fmul+ops.fdiv*fdiv+ops.fcmp*fcmp
+    +ops.fconv*fconv+ops.fsqrt*fsqrt+ops.imod*imod+ops.ladd*ladd+ops.lmul*lmul;
+}
+
+#ifdef PULSE_COST_MODEL
+
+thread_local OpCounts opcount_ops;
+thread_local OpCounts opcount_stage_ops[OPCOUNT_STAGES];
+static thread_local OpCounts last_mark;
+
+void opcount_mark(int stage) {
+  opcount_stage_ops[stage] += opcount_ops-last_mark;
+  last_mark = opcount_ops;
+}
+
+void opcount_reset() {
+  opcount_ops = OpCounts();
+  last_mark = OpCounts();
+  for (int i = 0; i < OPCOUNT_STAGES; i++)
+    opcount_stage_ops[i] = OpCounts();
+}
+
+#endif
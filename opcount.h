@@ -0,0 +1,142 @@
+#ifndef OPCOUNT_H
+#define OPCOUNT_H
+
+#include <type_traits>
+#include <math.h>
+
+// A cost model for estimating how many ESP8266 cycles the tracker takes, from a host build.
+// The ESP8266 has no FPU and no hardware divider, so every float op and integer % is a
+// library call that costs far more than it does on a PC, and profiling on a PC is misleading.
+//
+// Build with PULSE_COST_MODEL defined and pfloat becomes a float that counts every operation
+// done with it, the ring buffers count their index modulos, and the exact 64 bit sums
+// (PeakRange, SignalQuality, HeartRateVariability) count their adds and multiplies by hand.
+// Weighing the counts with a CycleTable gives the estimate. Without PULSE_COST_MODEL, pfloat is
+// just a float and all of the counting compiles away, so this costs nothing on the device.
+// The counts are per thread, so trackers on other threads (like a sweep's) don't race on them.
+
+// the stages of PulseTrackerInternals::push that ops are attributed to
+#define OPCOUNT_STAGE_SIGNAL 0 // quality and the signal window
+#define OPCOUNT_STAGE_SLOPE 1 // slope_and_max & detect_peak
+#define OPCOUNT_STAGE_STATS 2 // update_widths & update_stats
+#define OPCOUNT_STAGE_VALIDATE 3 // inspect_pulse & resolve_questionable
+#define OPCOUNT_STAGE_HR 4 // update_deltas & update_hr
+#define OPCOUNT_STAGES 5
+#define OPCOUNT_STAGE_NAMES {"signal", "slope", "stats", "validate", "hr"}
+
+struct OpCounts {
+  unsigned long fadd = 0; // float add & subtract
+  unsigned long fmul = 0;
+  unsigned long fdiv = 0;
+  unsigned long fcmp = 0;
+  unsigned long fconv = 0; // int <-> float
+  unsigned long fsqrt = 0;
+  unsigned long imod = 0; // integer % and / (ring buffer indices, mostly)
+  unsigned long ladd = 0; // 64 bit (long long) add & subtract
+  unsigned long lmul = 0; // 64 bit multiply
+  OpCounts operator-(const OpCounts& o) const;
+  OpCounts& operator+=(const OpCounts& o);
+  unsigned long total() const { return fadd+fmul+fdiv+fcmp+fconv+fsqrt+imod+ladd+lmul; }
+};
+
+// Estimated cycles per op on the ESP8266 (80MHz, soft float from the ROM/libgcc).
+// These are rough, and should be replaced with ESP.getCycleCount() measurements where it matters.
+struct CycleTable {
+  float fadd = 70;
+  float fmul = 80;
+  float fdiv = 250;
+  float fcmp = 30;
+  float fconv = 50;
+  float fsqrt = 600;
+  float imod = 50;
+  float ladd = 6; // inline, an add or subtract and a carry per half
+  float lmul = 40; // __muldi3, from 32 bit multiplies since there's no high word multiply
+  float cycles(const OpCounts& ops) const;
+};
+
+#ifdef PULSE_COST_MODEL
+
+// ops so far on this thread
+extern thread_local OpCounts opcount_ops;
+// ops so far on this thread attributed to each stage
+extern thread_local OpCounts opcount_stage_ops[OPCOUNT_STAGES];
+// attributes this thread's ops since its last call to stage
+void opcount_mark(int stage);
+// forgets all of this thread's counts
+void opcount_reset();
+
+#define OPCOUNT(op) (opcount_ops.op++)
+#define OPCOUNT_N(op, n) (opcount_ops.op += (n))
+#define OPCOUNT_MARK(stage) opcount_mark(stage)
+
+// A float that counts the operations done on it
+class CountedFloat {
+  private:
+    float v;
+    template <typename T>
+    static constexpr bool arith = std::is_arithmetic<T>::value;
+    template <typename T>
+    static float conv(T x) {
+      if (std::is_integral<T>::value)
+        OPCOUNT(fconv);
+      return x;
+    }
+  public:
+    CountedFloat() = default;
+    template <typename T, typename = typename std::enable_if<arith<T>>::type>
+    CountedFloat(T x) : v(x) {
+      if (std::is_integral<T>::value)
+        OPCOUNT(fconv);
+    }
+    operator float() const { return v; }
+    float value() const { return v; }
+
+    CountedFloat operator-() const { CountedFloat r; r.v = -v; return r; }
+    CountedFloat& operator+=(CountedFloat o) { OPCOUNT(fadd); v += o.v; return *this; }
+    CountedFloat& operator-=(CountedFloat o) { OPCOUNT(fadd); v -= o.v; return *this; }
+    CountedFloat& operator*=(CountedFloat o) { OPCOUNT(fmul); v *= o.v; return *this; }
+    CountedFloat& operator/=(CountedFloat o) { OPCOUNT(fdiv); v /= o.v; return *this; }
+
+    // Mixed operands are templates so they're exact matches, and win out
+    // over converting to float and using the builtin (uncounted) operators.
+#define OPCOUNT_BINARY(sym, op) \
+    friend CountedFloat operator sym(CountedFloat a, CountedFloat b) { OPCOUNT(op); CountedFloat r; r.v = a.v sym b.v; return r; } \
+    template <typename T, typename = typename std::enable_if<arith<T>>::type> \
+    friend CountedFloat operator sym(CountedFloat a, T b) { OPCOUNT(op); CountedFloat r; r.v = a.v sym conv(b); return r; } \
+    template <typename T, typename = typename std::enable_if<arith<T>>::type> \
+    friend CountedFloat operator sym(T a, CountedFloat b) { OPCOUNT(op); CountedFloat r; r.v = conv(a) sym b.v; return r; }
+    OPCOUNT_BINARY(+, fadd)
+    OPCOUNT_BINARY(-, fadd)
+    OPCOUNT_BINARY(*, fmul)
+    OPCOUNT_BINARY(/, fdiv)
+#undef OPCOUNT_BINARY
+
+#define OPCOUNT_COMPARE(sym) \
+    friend bool operator sym(CountedFloat a, CountedFloat b) { OPCOUNT(fcmp); return a.v sym b.v; } \
+    template <typename T, typename = typename std::enable_if<arith<T>>::type> \
+    friend bool operator sym(CountedFloat a, T b) { OPCOUNT(fcmp); return a.v sym conv(b); } \
+    template <typename T, typename = typename std::enable_if<arith<T>>::type> \
+    friend bool operator sym(T a, CountedFloat b) { OPCOUNT(fcmp); return conv(a) sym b.v; }
+    OPCOUNT_COMPARE(<)
+    OPCOUNT_COMPARE(<=)
+    OPCOUNT_COMPARE(>)
+    OPCOUNT_COMPARE(>=)
+    OPCOUNT_COMPARE(==)
+    OPCOUNT_COMPARE(!=)
+#undef OPCOUNT_COMPARE
+
+    friend CountedFloat sqrt(CountedFloat x) { OPCOUNT(fsqrt); CountedFloat r; r.v = sqrtf(x.v); return r; }
+};
+
+typedef CountedFloat pfloat;
+
+#else
+
+#define OPCOUNT(op)
+#define OPCOUNT_N(op, n)
+#define OPCOUNT_MARK(stage)
+typedef float pfloat;
+
+#endif
+
+#endif
@@ -0,0 +1,72 @@
+#include "opcount_test.h"
+#include <cstdio>
+
+#define ASSERT(t, msg, ...) if(!(t)){char l[128];sprintf(l, msg __VA_OPT__(,) __VA_ARGS__);Serial.println(l);return false;}
+
+bool test_cycle_table() {
+  Serial.println("Testing CycleTable...");
+  OpCounts ops;
+  ops.fadd = 3;
+  ops.fdiv = 2;
+  ops.imod = 5;
+  ops.lmul = 4;
+  CycleTable table;
+  ASSERT(table.cycles(ops) == 3*table.fadd+2*table.fdiv+5*table.imod+4*table.lmul, "cycles = %f", table.cycles(ops));
+  table.fdiv = 0;
+  ASSERT(table.cycles(ops) == 3*table.fadd+5*table.imod+4*table.lmul, "Didn't use the configured fdiv cost");
+  OpCounts more = ops;
+  more += ops;
+  ASSERT(more.total() == 2*ops.total(), "total = %lu and not %lu", more.total(), 2*ops.total());
+  ASSERT((more-ops).total() == ops.total(), "Subtraction is off");
+  return true;
+}
+
+#ifdef PULSE_COST_MODEL
+bool test_counted_float() {
+  Serial.println("Testing CountedFloat...");
+  opcount_reset();
+  pfloat a = 1.5;
+  pfloat b = a*a+a;
+  ASSERT(opcount_ops.fmul == 1 && opcount_ops.fadd == 1, "%lu muls and %lu adds", opcount_ops.fmul, opcount_ops.fadd);
+  ASSERT(b == 3.75f, "b = %f and not 3.75", b.value());
+  int n = 3;
+  opcount_reset();
+  b = b/n;
+  ASSERT(opcount_ops.fdiv == 1 && opcount_ops.fconv == 1 && opcount_ops.fcmp == 0, "Mixed int divide miscounted");
+  b = sqrt(b);
+  b -= 1;
+  ASSERT(opcount_ops.fsqrt == 1 && opcount_ops.fadd == 1, "%lu sqrts and %lu adds", opcount_ops.fsqrt, opcount_ops.fadd);
+  ASSERT(b > 0 && opcount_ops.fcmp == 1, "Compare miscounted");
+  // plain floats taken out of a pfloat aren't counted
+  float f = b;
+  f = f*f;
+  ASSERT(opcount_ops.fmul == 0, "Counted a plain float");
+  // the 64 bit sums are counted by hand
+  OPCOUNT_N(ladd, 3);
+  OPCOUNT(lmul);
+  ASSERT(opcount_ops.ladd == 3 && opcount_ops.lmul == 1, "%lu 64 bit adds and %lu muls", opcount_ops.ladd, opcount_ops.lmul);
+
+  opcount_reset();
+  b = 1;
+  opcount_mark(OPCOUNT_STAGE_SLOPE);
+  b = b+b;
+  opcount_mark(OPCOUNT_STAGE_HR);
+  ASSERT(opcount_stage_ops[OPCOUNT_STAGE_SLOPE].total() == 1, "Ops before the first mark went astray");
+  ASSERT(opcount_stage_ops[OPCOUNT_STAGE_HR].fadd == 1, "Ops between marks went astray");
+  return true;
+}
+#endif
+
+bool all_opcount_tests() {
+  Serial.println("Running tests for \"opcount.h\\cpp\"...");
+
+  ASSERT(test_cycle_table(), "CycleTable Failed");
+  #ifdef PULSE_COST_MODEL
+  ASSERT(test_counted_float(), "CountedFloat Failed");
+  #else
+  Serial.println("PULSE_COST_MODEL isn't defined, so there's nothing counting");
+  #endif
+
+  Serial.println("All tests pass!");
+  return true;
+}
@@ -0,0 +1,9 @@
+#ifndef OPCOUNT_TEST_H
+#define OPCOUNT_TEST_H
+
+#include <Arduino.h>
+#include "opcount.h"
+
+bool all_opcount_tests();
+
+#endif
@@ -1,50 +1,440 @@
 #include "pulse.h"
+#include "hrhistory.h"
+#include "hrv.h"
 
+#include <climits>
 #include <cstring>
 #include <math.h>
 
-void PulseTrackerInternals::slope_and_max(float* slope, int* max_index, int* max_amp) {
+// helpers for writing/reading snapshots, these return false when out of room
+template <typename T>
+static bool put(char*& p, const char* end, const T& v) {
+  if (end-p < (int)sizeof(T))
+    return false;
+  memcpy(p, &v, sizeof(T));
+  p += sizeof(T);
+  return true;
+}
+template <typename T>
+static bool get(const char*& p, const char* end, T* v) {
+  if (end-p < (int)sizeof(T))
+    return false;
+  memcpy(v, p, sizeof(T));
+  p += sizeof(T);
+  return true;
+}
+static bool skip(const char*& p, const char* end, int n) {
+  if (n < 0 || end-p < n)
+    return false;
+  p += n;
+  return true;
+}
+// CRC-32 (the zlib one), bit by bit since a snapshot is only checked once per restore
+static uint32_t crc32(const char* data, int n) {
+  uint32_t crc = 0xFFFFFFFF;
+  for (int i = 0; i < n; i++) {
+    crc ^= (uint8_t)data[i];
+    for (int b = 0; b < 8; b++)
+      crc = (crc>>1)^(0xEDB88320&-(crc&1));
+  }
+  return ~crc;
+}
+
+PeakRange PeakRange::of(const Peak& p) {
+  PeakRange r = empty();
+  if (p.w >= 0) {
+    long w = p.w;
+    r.w = w;
+    OPCOUNT(lmul);
+    r.w2 = (long long)w*w;
+    r.w_count = 1;
+    r.w_min = w;
+    r.w_max = w;
+  }
+  if (p.d >= 0) {
+    long d = p.d;
+    r.d = d;
+    OPCOUNT(lmul);
+    r.d2 = (long long)d*d;
+    r.d_count = 1;
+    r.d_min = d;
+    r.d_max = d;
+  }
+  return r;
+}
+PeakRange PeakRange::empty() {
+  PeakRange r;
+  r.w = r.w2 = r.d = r.d2 = 0;
+  r.w_count = r.d_count = 0;
+  r.w_min = r.d_min = LONG_MAX;
+  r.w_max = r.d_max = LONG_MIN;
+  return r;
+}
+PeakRange PeakRange::operator+(const PeakRange& o) const {
+  PeakRange r;
+  OPCOUNT_N(ladd, 4);
+  r.w = w+o.w;
+  r.w2 = w2+o.w2;
+  r.d = d+o.d;
+  r.d2 = d2+o.d2;
+  r.w_count = w_count+o.w_count;
+  r.d_count = d_count+o.d_count;
+  r.w_min = w_min < o.w_min ? w_min : o.w_min;
+  r.w_max = w_max > o.w_max ? w_max : o.w_max;
+  r.d_min = d_min < o.d_min ? d_min : o.d_min;
+  r.d_max = d_max > o.d_max ? d_max : o.d_max;
+  return r;
+}
+pfloat PeakRange::w_var() const {
+  if (w_count == 0)
+    return 0;
+  // n*sum(w^2)-sum(w)^2 is exact, unlike avg(w^2)-avg(w)^2 in floats
+  OPCOUNT_N(lmul, 2);
+  OPCOUNT(ladd);
+  return (pfloat)(w_count*w2-w*w)/((pfloat)w_count*w_count);
+}
+pfloat PeakRange::d_var() const {
+  if (d_count == 0)
+    return 0;
+  OPCOUNT_N(lmul, 2);
+  OPCOUNT(ladd);
+  return (pfloat)(d_count*d2-d*d)/((pfloat)d_count*d_count);
+}
+
+PeakBuffer::PeakBuffer(int capacity)
+  : RingBuffer<Peak>(capacity), tree(new PeakRange[capacity]) {
+  // every slot needs to be a valid (empty) leaf before building the tree
+  for (int i = 0; i < capacity; i++) {
+    (*this)[i].w = -1;
+    (*this)[i].d = -1;
+  }
+  refresh_all();
+}
+PeakRange PeakBuffer::node(int k) const {
+  if (k < capacity())
+    return tree[k];
+  int slot = k-capacity();
+  return PeakRange::of((*this)[(capacity()+slot-physical(0))%capacity()]);
+}
+Peak& PeakBuffer::push_back() {
+  Peak& p = RingBuffer<Peak>::push_back();
+  p.w = -1;
+  p.d = -1;
+  p.med = -1;
+  p.mad = -1;
+  refresh(size()-1);
+  return p;
+}
+void PeakBuffer::refresh(int i) {
+  for (int k = (physical(i)+capacity())/2; k >= 1; k /= 2)
+    tree[k] = node(2*k)+node(2*k+1);
+}
+void PeakBuffer::refresh_all() {
+  for (int k = capacity()-1; k >= 1; k--)
+    tree[k] = node(2*k)+node(2*k+1);
+}
+PeakRange PeakBuffer::tree_range(int from, int to) const {
+  PeakRange r = PeakRange::empty();
+  for (int l = from+capacity(), h = to+capacity(); l < h; l /= 2, h /= 2) {
+    if (l&1)
+      r = r+node(l++);
+    if (h&1)
+      r = r+node(--h);
+  }
+  return r;
+}
+PeakRange PeakBuffer::range(int start, int end) const {
+  if (start >= end)
+    return PeakRange::empty();
+  int from = physical(start);
+  int last = physical(end-1);
+  if (from <= last)
+    return tree_range(from, last+1);
+  // wraps around the end of the buffer
+  return tree_range(from, capacity())+tree_range(0, last+1);
+}
+
+void WindowedQuantiles::clear() {
+  h = 0;
+  len = 0;
+}
+void WindowedQuantiles::add(pfloat x) {
+  OPCOUNT(fconv);
+  uint16_t v = x < 0 ? 0 : (x > 65535 ? 65535 : (uint16_t)(x+0.5f));
+  int i = len;
+  if (len == PULSE_HR_QUANTILE_DELTAS) {
+    // take the oldest value out of the sorted values, leaving a hole at i
+    uint16_t drop = fifo[h];
+    int lo = 0, hi = len-1;
+    while (lo < hi) {
+      int mid = (lo+hi)/2;
+      if (sorted[mid] < drop)
+        lo = mid+1;
+      else
+        hi = mid;
+    }
+    i = lo;
+    fifo[h] = v;
+    if (++h == PULSE_HR_QUANTILE_DELTAS)
+      h = 0;
+  } else {
+    fifo[len++] = v;
+  }
+  // slide the hole to where v goes
+  while (i > 0 && sorted[i-1] > v) {
+    sorted[i] = sorted[i-1];
+    i--;
+  }
+  while (i < len-1 && sorted[i+1] < v) {
+    sorted[i] = sorted[i+1];
+    i++;
+  }
+  sorted[i] = v;
+}
+bool WindowedQuantiles::valid() const {
+  if (len < 0 || len > PULSE_HR_QUANTILE_DELTAS || h < 0 || h >= PULSE_HR_QUANTILE_DELTAS)
+    return false;
+  // the oldest value is only past the start once the window is full
+  return h == 0 || len == PULSE_HR_QUANTILE_DELTAS;
+}
+pfloat WindowedQuantiles::at(pfloat quantile) const {
+  if (len == 0)
+    return -1;
+  OPCOUNT(fconv);
+  return sorted[(int)(quantile*(len-1)+0.5f)];
+}
+
+OrderStatWindow::OrderStatWindow(int capacity)
+  : counts(new uint16_t[PULSE_ORDER_BINS+1]), fifo(new uint16_t[capacity]), cap(capacity) {
+  log_bins = 1;
+  while ((1<<log_bins) <= PULSE_ORDER_BINS)
+    log_bins++;
+  clear();
+}
+void OrderStatWindow::add(int bin, int delta) {
+  for (int i = bin+1; i <= PULSE_ORDER_BINS; i += i&-i)
+    counts[i] += delta;
+}
+int OrderStatWindow::count_le(int bin) const {
+  if (bin < 0)
+    return 0;
+  if (bin >= PULSE_ORDER_BINS)
+    bin = PULSE_ORDER_BINS-1;
+  int n = 0;
+  for (int i = bin+1; i > 0; i -= i&-i)
+    n += counts[i];
+  return n;
+}
+int OrderStatWindow::kth(int k) const {
+  // walk down the fenwick tree, skipping over whole blocks with <= k values
+  int pos = 0;
+  for (int step = 1<<(log_bins-1); step > 0; step >>= 1) {
+    if (pos+step <= PULSE_ORDER_BINS && counts[pos+step] <= k) {
+      pos += step;
+      k -= counts[pos];
+    }
+  }
+  return pos;
+}
+void OrderStatWindow::push_back(pfloat value) {
+  OPCOUNT(fconv);
+  int bin = value < 0 ? 0 : (int)(value*(1.0f/PULSE_ORDER_BIN_MS)+0.5f);
+  if (bin >= PULSE_ORDER_BINS)
+    bin = PULSE_ORDER_BINS-1;
+  if (len == cap)
+    pop_front();
+  OPCOUNT(imod);
+  fifo[(h+len)%cap] = bin;
+  len++;
+  add(bin, 1);
+}
+void OrderStatWindow::pop_front() {
+  add(fifo[h], -1);
+  if (++h == cap)
+    h = 0;
+  len--;
+}
+void OrderStatWindow::pop_back() {
+  len--;
+  OPCOUNT(imod);
+  add(fifo[(h+len)%cap], -1);
+}
+void OrderStatWindow::clear() {
+  for (int i = 0; i <= PULSE_ORDER_BINS; i++)
+    counts[i] = 0;
+  h = 0;
+  len = 0;
+}
+pfloat OrderStatWindow::median() const {
+  if (len == 0)
+    return -1;
+  return (pfloat)(kth((len-1)/2)+kth(len/2))*(PULSE_ORDER_BIN_MS/2.0f);
+}
+pfloat OrderStatWindow::mad() const {
+  if (len == 0)
+    return -1;
+  int m = kth((len-1)/2);
+  // smallest radius r (in bins) with at least half of the values within r of the median
+  int lo = 0;
+  int hi = PULSE_ORDER_BINS;
+  while (lo < hi) {
+    int r = (lo+hi)/2;
+    if (count_le(m+r)-count_le(m-r-1) >= (len+1)/2)
+      hi = r;
+    else
+      lo = r+1;
+  }
+  return (pfloat)(lo*PULSE_ORDER_BIN_MS);
+}
+
+char SignalQuality::push(int signal, long time) {
+  bool dropped_extreme = false;
+  // drop the samples that have slid out of the window, and the oldest if jitter squeezed in an extra one
+  while (times.size() > 0 && (times[0] <= time-window_ms || window.full())) {
+    int drop = window[0];
+    OPCOUNT_N(ladd, 2);
+    sum -= drop;
+    sum2 -= drop*drop;
+    if (drop <= PULSE_QUALITY_CLIP_LOW || drop >= PULSE_QUALITY_CLIP_HIGH)
+      clipped--;
+    // no rescan needed if the new signal takes over as the extreme
+    dropped_extreme = dropped_extreme || (drop == min && signal > min) || (drop == max && signal < max);
+    window.pop_front();
+    times.pop_front();
+  }
+  window.push_back() = signal;
+  times.push_back() = time;
+  OPCOUNT_N(ladd, 2);
+  sum += signal;
+  sum2 += signal*signal;
+  if (signal <= PULSE_QUALITY_CLIP_LOW || signal >= PULSE_QUALITY_CLIP_HIGH)
+    clipped++;
+  // the range only needs a rescan when an extreme leaves the window
+  if (window.size() == 1) {
+    min = signal;
+    max = signal;
+  } else if (dropped_extreme) {
+    rescan_range();
+  } else {
+    if (signal < min)
+      min = signal;
+    if (signal > max)
+      max = signal;
+  }
+  if (!window_full()) {
+    state = '_';
+    return state;
+  }
+  if (clipped*100 > PULSE_QUALITY_MAX_CLIPPED*window.size())
+    state = 'c';
+  else if (range() < PULSE_QUALITY_MIN_RANGE || variance() < PULSE_QUALITY_MIN_VARIANCE)
+    state = 'f';
+  else if (range() > PULSE_QUALITY_MAX_RANGE)
+    state = 'm';
+  else
+    state = 'g';
+  return state;
+}
+bool SignalQuality::window_full() const {
+  int n = times.size();
+  if (n < 2)
+    return false;
+  long last = times[n-1];
+  long interval = last-times[n-2];
+  return last-times[0]+interval > window_ms-interval/2;
+}
+void SignalQuality::rescan_range() {
+  min = window[0];
+  max = window[0];
+  for (int i = 1; i < window.size(); i++) {
+    if (window[i] < min)
+      min = window[i];
+    if (window[i] > max)
+      max = window[i];
+  }
+}
+pfloat SignalQuality::variance() const {
+  int n = window.size();
+  if (n == 0)
+    return 0;
+  OPCOUNT_N(lmul, 2);
+  OPCOUNT(ladd);
+  return (pfloat)(n*sum2-sum*sum)/((pfloat)n*n);
+}
+void SignalQuality::clear() {
+  window.clear();
+  times.clear();
+  sum = 0;
+  sum2 = 0;
+  clipped = 0;
+  min = 0;
+  max = 0;
+  state = '_';
+}
+
+void PulseTrackerInternals::slope_and_max(pfloat* slope, int* max_index, int* max_amp) {
   // OPT: could make this O(1) except with occasional fp-err fixes,
-  // but PULSE_SLOPE_WINDOW is small, so that's unnecessary for now.
-  float avgp = 0;
-  for(int i = 0; i < pulse_signals.size(); i++)
+  // but the slope window is small, so that's unnecessary for now.
+  // The samples aren't necessarily evenly spaced, so this is the least squares slope
+  // against their times (relative to the first, to keep the floats small).
+  int n = pulse_signals.size();
+  long t0 = signal_times[0];
+  pfloat avgp = 0;
+  pfloat avgt = 0;
+  for(int i = 0; i < n; i++) {
     avgp += pulse_signals[i];
-  avgp /= pulse_signals.size();
-  const float avgi = (pulse_signals.size()-1)/2.0;
-  float sip = 0;
+    avgt += signal_times[i]-t0;
+  }
+  avgp /= n;
+  avgt /= n;
+  pfloat stp = 0;
   int max = pulse_signals[0];
   int max_i = 0;
-  for(int i = 0; i < pulse_signals.size(); i++) {
+  for(int i = 0; i < n; i++) {
     int p = pulse_signals[i];
-    sip += (i-avgi)*(p-avgp);
+    stp += (signal_times[i]-t0-avgt)*(p-avgp);
     if (max < p) {
       max = p;
       max_i = i;
     }
   }
-  (*slope) = sip; // didnt divide by Sii because we don't care about the scale factor of the slope, just the sign
+  (*slope) = stp; // didnt divide by Stt because we don't care about the scale factor of the slope, just the sign
   (*max_index) = max_i;
   (*max_amp) = max;
 }
-bool PulseTrackerInternals::detect_peak(long now) {
-  if (!pulse_signals.full())
+bool PulseTrackerInternals::slope_window_full() const {
+  int n = signal_times.size();
+  if (n < 3)
     return false;
-  float slope;
+  long last = signal_times[n-1];
+  long interval = last-signal_times[n-2];
+  // each sample stands for an interval's worth of signal, so the samples cover the
+  // window if their span plus an interval does, give or take half an interval for jitter
+  return last-signal_times[0]+interval > params.slope_window_ms-interval/2;
+}
+bool PulseTrackerInternals::detect_peak() {
+  if (!slope_window_full())
+    return false;
+  pfloat slope;
   int max_i;
   int max_amp;
   slope_and_max(&slope, &max_i, &max_amp);
- 
+  return detect_peak(slope, max_i, max_amp);
+}
+bool PulseTrackerInternals::detect_peak(pfloat slope, int max_i, int max_amp) {
   bool maximum = last_slope > 0 && slope <= 0;
   last_slope = slope;
   if (!maximum)
     return false;
 
   Peak& peak = peaks.push_back();
-  peak.t = now-(PULSE_SLOPE_WINDOW-max_i-1)*1000/PULSE_SAMPLE_RATE;
+  peak.t = signal_times[max_i];
   peak.amp = max_amp;
   peak.w = -1;
   peak.avg = -1;
   peak.std = -1;
+  peak.med = -1;
+  peak.mad = -1;
   peak.val = '_';
   peak.d = -1;
   return true;
@@ -54,12 +444,14 @@ void PulseTrackerInternals::update_widths() {
   if(peaks.size() < 3) {
     // we need at least 3 peaks to calculate the width
     peaks.back().w = 0;
+    peaks.refresh(peaks.size()-1);
     return;
   }
   peaks[widths_head].w = peaks[widths_head+1].t-peaks[widths_head-1].t;
+  peaks.refresh(widths_head);
 }
 bool PulseTrackerInternals::update_stats() {
-  // "validation window" = the time > PULSE_VALIDATION_WINDOW_MS around the peak at stats_head
+  // "validation window" = the time > params.validation_window_ms around the peak at stats_head
   // In practice, the validation window should go from [stats_tail to widths_head-1] with
   // stats_head approximately in the middle.
   // This function works as follows:
@@ -73,21 +465,22 @@ bool PulseTrackerInternals::update_stats() {
     stats_tail = 0;
   // if we can't fit the validation window around the stats head and have only peaks with measured widths,
   // we can't update
-  if(stats_head >= peaks.size()
-    || widths_head-1 < 0
-    || (peaks[widths_head-1].t-peaks[stats_head].t)<PULSE_VALIDATION_WINDOW_MS/2) {
+  if(stats_head >= peaks.size() || widths_head-1 < 0)
+    return false;
+  if (warming_up)
+    return update_provisional_stats();
+  if ((peaks[widths_head-1].t-peaks[stats_head].t)<params.validation_window_ms/2)
     return false;
-  }
   
   // move the stats_tail forward in time if there is slack in the validation window
-  while(stats_tail < stats_head && (peaks[stats_head].t-peaks[stats_tail+1].t)>PULSE_VALIDATION_WINDOW_MS/2) {
+  while(stats_tail < stats_head && (peaks[stats_head].t-peaks[stats_tail+1].t)>params.validation_window_ms/2) {
     stats_tail++;
   }
 
   // If the stats tail is too close, we can't calculate the stats.
   // This should only happen while we don't have enough peaks, or stats_head has fallen behind
   // because of a flood of high frequency peaks.
-  if (peaks[stats_head].t-peaks[stats_tail].t < PULSE_VALIDATION_WINDOW_MS/2) {
+  if (peaks[stats_head].t-peaks[stats_tail].t < params.validation_window_ms/2) {
     #ifdef PULSE_DEBUG
     if (peaks.full() && stats_tail > 0)
       Serial.println("Error: Stats tail moved too close!");
@@ -96,13 +489,83 @@ bool PulseTrackerInternals::update_stats() {
     return false;
   }
 
-  float avg = peaks.calc_smart_sum(widths_sum, stats_tail, widths_head)/(widths_head-stats_tail);
-  float avg2 = peaks.calc_smart_sum(widths2_sum, stats_tail, widths_head)/(widths_head-stats_tail);
-  peaks[stats_head].avg = avg;
-  peaks[stats_head].std = sqrt(avg2-avg*avg);
+  set_stats(stats_tail, widths_head);
+  stats_head++;
+  return true;
+}
+bool PulseTrackerInternals::update_provisional_stats() {
+  // Until there's a whole validation window of peaks, use every peak with a measured width
+  // (skipping the first, which never gets one) so that the later steps can start right away.
+  // After that the window slides from trailing the peak to centered on it, like update_stats':
+  // a peak x ms after the switch waits for min(x, validation_window_ms/2) of lead. That way stats_head
+  // falls back from the newest peak gradually (at half speed) instead of stalling for half a
+  // validation window, and the heart rate keeps updating through the switch.
+  int n = widths_head;
+  if (n < PULSE_PROVISIONAL_MIN_PEAKS || stats_head > widths_head)
+    return false;
+  const long half = params.validation_window_ms/2;
+  Peak& p = peaks[stats_head];
+  if (centering_since < 0 && peaks[widths_head-1].t-peaks[0].t >= params.validation_window_ms)
+    centering_since = p.t;
+  long lead = centering_since < 0 ? 0 : p.t-centering_since;
+  if (lead >= half) {
+    // the window is centered, so the regular update_stats takes over from here
+    warming_up = false;
+    full_stats_start = stats_head;
+    // the bounds are only from the deltas of peaks with full stats from here on
+    delta_quantiles.clear();
+    return true;
+  }
+  if (peaks[widths_head-1].t-p.t < lead)
+    return false;
+  // a whole validation window, less however much of it is lead
+  int start = 1;
+  while (start < stats_head && p.t-peaks[start].t > params.validation_window_ms-lead)
+    start++;
+  set_stats(start, widths_head+1);
   stats_head++;
   return true;
 }
+void PulseTrackerInternals::set_stats(int start, int end) {
+  PeakRange window = peaks.range(start, end);
+  Peak& p = peaks[stats_head];
+  p.avg = (pfloat)window.w/window.w_count;
+  p.std = sqrt(window.w_var());
+  if (robust_inspection) {
+    sync_order_window(start, end);
+    p.med = order_window->median();
+    p.mad = order_window->mad();
+  }
+}
+void PulseTrackerInternals::sync_order_window(int start, int end) {
+  if (!order_window) {
+    order_window = std::make_unique<OrderStatWindow>();
+    order_start = order_end = start;
+  }
+  // peaks that fell off the buffer are still in the window
+  while (order_start < 0 && order_window->size() > 0 && order_start < order_end) {
+    order_window->pop_front();
+    order_start++;
+  }
+  // the window can only slide forward, otherwise (e.g. when warming up ends) start over
+  if (order_start < 0 || start < order_start || start > order_end) {
+    order_window->clear();
+    order_start = start;
+    order_end = start;
+  }
+  while (order_end > end) {
+    order_window->pop_back();
+    order_end--;
+  }
+  while (order_start < start) {
+    order_window->pop_front();
+    order_start++;
+  }
+  while (order_end < end) {
+    order_window->push_back(peaks[order_end].w);
+    order_end++;
+  }
+}
 bool PulseTrackerInternals::inspect_pulse() {
   if (inspection_head < 0)
     inspection_head = 0;
@@ -115,10 +578,28 @@ bool PulseTrackerInternals::inspect_pulse() {
     inspection_head++;
     return true;
   }
-  if(p.std != 0 && (p.w-p.avg)/p.std < -1 && p.w/p.avg < 0.7)
+  if (robust_inspection) {
+    // 1.4826*MAD estimates the std of normally distributed widths, without being thrown off by outliers.
+    // The MAD is 0 when more than half the widths fall in one bin, so it's floored at a bin.
+    pfloat spread = 1.4826*(p.mad > PULSE_ORDER_BIN_MS ? p.mad : (pfloat)PULSE_ORDER_BIN_MS);
+    if ((p.w-p.med)/spread < params.false_pulse_z && p.w/p.med < params.false_pulse_ratio)
+      p.val = '?';
+    else
+      p.val = 'v';
+  } else if(p.std != 0 && (p.w-p.avg)/p.std < params.false_pulse_z && p.w/p.avg < params.false_pulse_ratio)
     p.val = '?';
   else
     p.val = 'v';
+  // A few widths can't tell a false pulse when most of them are false, like a dicrotic notch
+  // on every other beat early on, but the notch is always well below the beats either side.
+  if (p.val == 'v' && (warming_up || inspection_head < full_stats_start) && inspection_head > 0) {
+    int before = peaks[inspection_head-1].amp;
+    int after = peaks[inspection_head+1].amp;
+    int smaller = before < after ? before : after;
+    // peaks without an amplitude (<= 0) have nothing to compare
+    if (smaller > 0 && p.amp < PULSE_PROVISIONAL_AMP_RATIO*(pfloat)smaller)
+      p.val = '?';
+  }
 
   inspection_head++;
   return true;
@@ -174,8 +655,8 @@ bool PulseTrackerInternals::resolve_questionable() {
   
   // otherwise, calculate the average even and odd amplitudes
   // and mark the set with the smaller average as false
-  float avg_e = 0;
-  float avg_o = 0;
+  pfloat avg_e = 0;
+  pfloat avg_o = 0;
   for (int i = 0; i < num_questionable; i++){
     if(i%2==0)
       avg_e += peaks[resolution_tail+i].amp;
@@ -196,29 +677,362 @@ bool PulseTrackerInternals::resolve_questionable() {
 bool PulseTrackerInternals::update_deltas() {
   if (deltas_head < 0)
     deltas_head = 0;
-  // waiting for more.
-  if (deltas_head <= peaks.size() || deltas_head+1 >= resolution_tail)
+  // only the peaks behind resolution_tail have their final validation
+  if (deltas_head >= resolution_tail)
+    return false;
+  Peak& p = peaks[deltas_head];
+  if (p.val != 'v') {
+    p.d = -1;
+    peaks.refresh(deltas_head);
+    deltas_head++;
+    return true;
+  }
+  int next = deltas_head+1;
+  while (next < resolution_tail && peaks[next].val != 'v')
+    next++;
+  if (next >= resolution_tail) {
+    // waiting for the next valid peak to be resolved
     return false;
-  // TODO
-  return false;
+  }
+  p.d = peaks[next].t-p.t;
+  peaks.refresh(deltas_head);
+  // Deltas of peaks with provisional stats are only for the provisional hr. Once warming up is
+  // over they're left out of the bounds (see update_provisional_stats), and they never get to
+  // the HRV, which would otherwise carry any false pulses let through for a whole window.
+  bool provisional = warming_up || deltas_head < full_stats_start;
+  if (warming_up || !provisional)
+    delta_quantiles.add(p.d);
+  if (hrv != nullptr && !provisional)
+    hrv->add(p.t, p.d);
+  deltas_head++;
+  return true;
 }
 void PulseTrackerInternals::update_hr() {
-  // TODO
+  if (hr_tail < 0)
+    hr_tail = 0;
+  if (deltas_head <= 0)
+    return;
+  // snug up the tail to cover just the last PULSE_HR_WINDOW_MS of deltas
+  long end_t = peaks[deltas_head-1].t;
+  while (hr_tail < deltas_head-1 && end_t-peaks[hr_tail].t > PULSE_HR_WINDOW_MS)
+    hr_tail++;
+  PeakRange window = peaks.range(hr_tail, deltas_head);
+  if (window.d_count < 1)
+    return;
+  pfloat avg = (pfloat)window.d/window.d_count;
+  bool provisional = warming_up || hr_tail < full_stats_start;
+  if (provisional && window.d_count < PULSE_PROVISIONAL_MIN_DELTAS)
+    return;
+
+  pfloat rate = 60000/avg;
+  // the longest deltas are the slowest beats, and right after warming up there may not be any
+  // deltas in the quantiles yet, so the window's own do
+  pfloat lb = 60000/(delta_quantiles.size() > 0 ? delta_quantiles.upper() : (pfloat)window.d_max);
+  pfloat ub = 60000/(delta_quantiles.size() > 0 ? delta_quantiles.lower() : (pfloat)window.d_min);
+  // the average can fall outside of the quantiles when they're from just a few deltas
+  if (lb > rate)
+    lb = rate;
+  if (ub < rate)
+    ub = rate;
+  if (provisional) {
+    // at least as wide as the deltas the hr is from, then wider still since they're so few
+    pfloat slowest = 60000/(pfloat)window.d_max;
+    pfloat fastest = 60000/(pfloat)window.d_min;
+    if (lb > slowest)
+      lb = slowest;
+    if (ub < fastest)
+      ub = fastest;
+    lb = rate-(rate-lb)*PULSE_PROVISIONAL_BOUND_SCALE;
+    ub = rate+(ub-rate)*PULSE_PROVISIONAL_BOUND_SCALE;
+    pfloat min_bound = rate*PULSE_PROVISIONAL_MIN_BOUND;
+    if (lb > rate-min_bound)
+      lb = rate-min_bound;
+    if (ub < rate+min_bound)
+      ub = rate+min_bound;
+  }
+
+  // fill in the slot after back() before pushing it, so get_heartrate never sees a partial value
+  HeartRate& hr = hr_swap_buf[hr_swap_buf.size()];
+  hr.time = end_t;
+  hr.hr = rate;
+  hr.hr_lb = lb;
+  hr.hr_ub = ub;
+  hr.provisional = provisional;
+  if (hrv != nullptr && hrv->beats() >= HRV_MIN_BEATS) {
+    hr.rmssd = hrv->rmssd();
+    hr.sdnn = hrv->sdnn();
+    hr.pnn50 = hrv->pnn50();
+  } else {
+    hr.rmssd = -1;
+    hr.sdnn = -1;
+    hr.pnn50 = -1;
+  }
+  strcpy(hr.err, "");
+  hr_swap_buf.push_back();
+  // the history is kept for hours, so it only gets heart rates that are sure
+  if (history != nullptr && !provisional)
+    history->add(hr.time, hr.hr);
+}
+void PulseTrackerInternals::reset_peaks() {
+  peaks.clear();
+  widths_head = 0;
+  stats_head = 0;
+  stats_tail = 0;
+  inspection_head = 0;
+  resolution_head = 0;
+  resolution_tail = 0;
+  deltas_head = 0;
+  hr_tail = 0;
+  full_stats_start = 0;
+  centering_since = -1;
+  if (order_window)
+    order_window->clear();
+  order_start = 0;
+  order_end = 0;
+  warming_up = true;
+  delta_quantiles.clear();
+  hr_swap_buf.clear();
 }
 void PulseTrackerInternals::push(int pulse_signal, long time) {
+  if (!push_signal(pulse_signal, time))
+    return;
+  pfloat slope;
+  int max_i;
+  int max_amp;
+  slope_and_max(&slope, &max_i, &max_amp);
+  push_slope(slope, max_i, max_amp);
+}
+bool PulseTrackerInternals::push_signal(int pulse_signal, long time) {
+  last_time = time;
+  quality.push(pulse_signal, time);
+  if (quality_gate && !quality.usable()) {
+    // don't bother looking for peaks in junk
+    if (gated_since < 0)
+      gated_since = time;
+    OPCOUNT_MARK(OPCOUNT_STAGE_SIGNAL);
+    return false;
+  }
+  if (gated_since >= 0) {
+    // the slope window is full of junk, so start it over, and if the signal
+    // was bad for long enough, the peaks around the gap aren't worth keeping either
+    pulse_signals.clear();
+    signal_times.clear();
+    last_slope = -1;
+    if (time-gated_since > PULSE_QUALITY_RESET_MS)
+      reset_peaks();
+    gated_since = -1;
+  }
+  // drop the samples that have slid out of the slope window
+  while (signal_times.size() > 0 && signal_times[0] <= time-params.slope_window_ms) {
+    pulse_signals.pop_front();
+    signal_times.pop_front();
+  }
   pulse_signals.push_back() = pulse_signal;
-  if(!detect_peak(time))
+  signal_times.push_back() = time;
+  OPCOUNT_MARK(OPCOUNT_STAGE_SIGNAL);
+  return slope_window_full();
+}
+void PulseTrackerInternals::push_slope(pfloat slope, int max_index, int max_amp) {
+  bool peak = detect_peak(slope, max_index, max_amp);
+  OPCOUNT_MARK(OPCOUNT_STAGE_SLOPE);
+  if(!peak)
     return;
   update_widths();
   while(update_stats());
+  OPCOUNT_MARK(OPCOUNT_STAGE_STATS);
   while(inspect_pulse());
   while(resolve_questionable());
+  OPCOUNT_MARK(OPCOUNT_STAGE_VALIDATE);
+  int old_deltas_head = deltas_head;
+  while(update_deltas());
+  if (deltas_head != old_deltas_head)
+    update_hr();
+  OPCOUNT_MARK(OPCOUNT_STAGE_HR);
 }
 void PulseTrackerInternals::get_heartrate(HeartRate* out) const {
-  out->time = -1;
-  out->hr = -1;
-  out->hr_lb = -1;
-  out->hr_ub = -1;
-  strcpy(out->err,"");
-  // TODO
-}
\ No newline at end of file
+  if (hr_swap_buf.size() > 0) {
+    (*out) = hr_swap_buf[hr_swap_buf.size()-1];
+  } else {
+    out->time = -1;
+    out->hr = -1;
+    out->hr_lb = -1;
+    out->hr_ub = -1;
+    out->provisional = false;
+    out->rmssd = -1;
+    out->sdnn = -1;
+    out->pnn50 = -1;
+    strcpy(out->err,"No heart rate yet");
+  }
+  // the last heart rate is kept, but flagged, while the signal is bad
+  if (gated_since >= 0) {
+    switch(quality.state) {
+      case 'f': strcpy(out->err, "Poor signal: flat"); break;
+      case 'c': strcpy(out->err, "Poor signal: clipped"); break;
+      case 'm': strcpy(out->err, "Poor signal: motion"); break;
+    }
+  }
+}
+int PulseTrackerInternals::snapshot(char* out, int cap) const {
+  char* p = out;
+  const char* end = out+cap;
+  // header, so that snapshots from other builds get rejected
+  bool ok = put(p, end, 'P')
+    && put(p, end, (char)PULSE_SNAPSHOT_VERSION)
+    && put(p, end, (short)sizeof(Peak))
+    && put(p, end, (short)pulse_signals.capacity())
+    && put(p, end, (short)peaks.capacity())
+    && put(p, end, params.validation_window_ms)
+    && put(p, end, last_time)
+    && put(p, end, last_slope)
+    && put(p, end, pulse_signals.size());
+  for (int i = 0; ok && i < pulse_signals.size(); i++)
+    ok = put(p, end, pulse_signals[i]) && put(p, end, signal_times[i]);
+  ok = ok && put(p, end, peaks.size());
+  for (int i = 0; ok && i < peaks.size(); i++)
+    ok = put(p, end, peaks[i]);
+  ok = ok
+    && put(p, end, widths_head)
+    && put(p, end, stats_head)
+    && put(p, end, stats_tail)
+    && put(p, end, inspection_head)
+    && put(p, end, resolution_head)
+    && put(p, end, resolution_tail)
+    && put(p, end, deltas_head)
+    && put(p, end, hr_tail)
+    && put(p, end, full_stats_start)
+    && put(p, end, warming_up)
+    && put(p, end, centering_since)
+    && put(p, end, delta_quantiles)
+    && put(p, end, (char)(hr_swap_buf.size() > 0));
+  if (ok && hr_swap_buf.size() > 0)
+    ok = put(p, end, hr_swap_buf[hr_swap_buf.size()-1]);
+  ok = ok && put(p, end, crc32(out, p-out));
+  if (!ok)
+    return -1;
+  return p-out;
+}
+int PulseTrackerInternals::restore(const char* in, int n, long now, long gap_ms) {
+  if (gap_ms > PULSE_MAX_RESTORE_GAP_MS)
+    return PULSE_RESTORE_STALE;
+  const char* p = in;
+  const char* end = in+n;
+  char magic, version;
+  short peak_size, signals_cap, peaks_cap;
+  long saved_time;
+  pfloat saved_slope;
+  int n_signals, n_peaks;
+  if (!get(p, end, &magic) || !get(p, end, &version))
+    return PULSE_RESTORE_TRUNCATED;
+  if (magic != 'P' || version != PULSE_SNAPSHOT_VERSION)
+    return PULSE_RESTORE_MISMATCH;
+  long validation_window_ms;
+  if (!get(p, end, &peak_size) || !get(p, end, &signals_cap) || !get(p, end, &peaks_cap)
+      || !get(p, end, &validation_window_ms))
+    return PULSE_RESTORE_TRUNCATED;
+  // the stats of the saved peaks are from a different window (or slope window) otherwise
+  if (peak_size != sizeof(Peak) || signals_cap != pulse_signals.capacity() || peaks_cap != peaks.capacity()
+      || validation_window_ms != params.validation_window_ms)
+    return PULSE_RESTORE_MISMATCH;
+  if (!get(p, end, &saved_time) || !get(p, end, &saved_slope) || !get(p, end, &n_signals))
+    return PULSE_RESTORE_TRUNCATED;
+  if (n_signals < 0 || n_signals > signals_cap)
+    return PULSE_RESTORE_MISMATCH;
+  const char* signals = p;
+  if (!skip(p, end, n_signals*(sizeof(int)+sizeof(long))) || !get(p, end, &n_peaks))
+    return PULSE_RESTORE_TRUNCATED;
+  if (n_peaks < 0 || n_peaks > peaks_cap)
+    return PULSE_RESTORE_MISMATCH;
+  const char* saved_peaks = p;
+  if (!skip(p, end, n_peaks*sizeof(Peak)))
+    return PULSE_RESTORE_TRUNCATED;
+  // the stage heads, read up front so they can be checked before anything's changed
+  int saved_heads[9];
+  bool saved_warming_up;
+  long saved_centering_since;
+  WindowedQuantiles saved_quantiles;
+  char has_hr;
+  HeartRate saved_hr;
+  for (int i = 0; i < 9; i++) {
+    if (!get(p, end, &saved_heads[i]))
+      return PULSE_RESTORE_TRUNCATED;
+  }
+  if (!get(p, end, &saved_warming_up) || !get(p, end, &saved_centering_since)
+      || !get(p, end, &saved_quantiles) || !get(p, end, &has_hr)
+      || (has_hr && !get(p, end, &saved_hr)))
+    return PULSE_RESTORE_TRUNCATED;
+  uint32_t crc;
+  int payload = p-in;
+  if (!get(p, end, &crc))
+    return PULSE_RESTORE_TRUNCATED;
+  if (crc != crc32(in, payload))
+    return PULSE_RESTORE_CORRUPT;
+  // a head past the saved peaks would index garbage on the next push
+  for (int i = 0; i < 9; i++) {
+    if (saved_heads[i] < 0 || saved_heads[i] > n_peaks)
+      return PULSE_RESTORE_CORRUPT;
+  }
+  if (!saved_quantiles.valid())
+    return PULSE_RESTORE_CORRUPT;
+
+  // shift all the times so that the last push happened gap_ms ago
+  long shift = saved_time < 0 ? 0 : now-gap_ms-saved_time;
+  last_time = saved_time < 0 ? -1 : saved_time+shift;
+  pulse_signals.clear();
+  signal_times.clear();
+  last_slope = -1;
+  quality.clear();
+  gated_since = -1;
+  // with more than a sample missing the slope window would straddle the gap,
+  // so the signals have to be refilled from scratch. A sample is however long the
+  // last one took, since the rate might have dropped (see SampleRateController).
+  long interval = 1000/PULSE_SAMPLE_RATE;
+  if (n_signals >= 2) {
+    const char* last = signals+(n_signals-2)*(sizeof(int)+sizeof(long))+sizeof(int);
+    long t0 = 0, t1 = 0;
+    get(last, end, &t0);
+    skip(last, end, sizeof(int));
+    get(last, end, &t1);
+    interval = t1-t0;
+  }
+  if (gap_ms <= interval) {
+    last_slope = saved_slope;
+    for (int i = 0; i < n_signals; i++) {
+      get(signals, end, &pulse_signals.push_back());
+      get(signals, end, &signal_times.push_back());
+      signal_times.back() += shift;
+    }
+  }
+  peaks.clear();
+  for (int i = 0; i < n_peaks; i++) {
+    Peak& peak = peaks.push_back();
+    get(saved_peaks, end, &peak);
+    peak.t += shift;
+  }
+  peaks.refresh_all();
+  widths_head = saved_heads[0];
+  stats_head = saved_heads[1];
+  stats_tail = saved_heads[2];
+  inspection_head = saved_heads[3];
+  resolution_head = saved_heads[4];
+  resolution_tail = saved_heads[5];
+  deltas_head = saved_heads[6];
+  hr_tail = saved_heads[7];
+  full_stats_start = saved_heads[8];
+  warming_up = saved_warming_up;
+  centering_since = saved_centering_since;
+  if (centering_since >= 0)
+    centering_since += shift;
+  delta_quantiles = saved_quantiles;
+  // so there's a heart rate before the next beat
+  hr_swap_buf.clear();
+  if (has_hr) {
+    saved_hr.time += shift;
+    hr_swap_buf.push_back() = saved_hr;
+  }
+  // rebuilt from the peaks on the next update_stats
+  if (order_window)
+    order_window->clear();
+  order_start = 0;
+  order_end = 0;
+  return PULSE_RESTORE_OK;
+}
@@ -5,6 +5,8 @@
 #include <memory>
 #include <stdlib.h>
 
+#include "opcount.h"
+
 #define PULSE_DEBUG
 #ifdef PULSE_DEBUG
 #include <Arduino.h>
@@ -12,16 +14,47 @@
 
 #define PULSE_SAMPLE_RATE 40  // samples per second
 #define PULSE_SLOPE_WINDOW_MS 225
-#define PULSE_SLOPE_WINDOW (PULSE_SLOPE_WINDOW_MS*PULSE_SAMPLE_RATE/1000) // in num samples
+#define PULSE_SLOPE_WINDOW ((PULSE_SLOPE_WINDOW_MS*PULSE_SAMPLE_RATE+999)/1000+1) // the most samples in a slope window
 #define PULSE_PEAKS_LEN (15*250*3/(2*60)) // enough to cover about 15s of pulses at 250bpm, with an additiopnal 50% false pulses
 #define PULSE_VALIDATION_WINDOW_MS (10000) // 10s
-#define PULSE_MAX_SMART_SUM_AGE 10000
+#define PULSE_FALSE_PULSE_Z -1 // a peak is questionable if its width is this many stds (or scaled MADs) from the window's
+#define PULSE_FALSE_PULSE_RATIO 0.7 // and it's less than this fraction of the window's average (or median) width
+#define PULSE_HR_WINDOW_MS 5000 // heart rate is averaged over the deltas in this window
+#define PULSE_PROVISIONAL_MIN_PEAKS 3 // need at least this many widths for provisional stats
+#define PULSE_PROVISIONAL_BOUND_SCALE 2 // provisional hr bounds are this many times wider
+#define PULSE_PROVISIONAL_MIN_BOUND 0.1 // and at least this fraction of the hr either side
+#define PULSE_PROVISIONAL_MIN_DELTAS 2 // no provisional hr from fewer deltas than this
+#define PULSE_PROVISIONAL_AMP_RATIO 0.8 // with provisional stats, a peak this much smaller than both neighbours is questionable
+#define PULSE_QUALITY_WINDOW_MS 1000 // how much of the signal to judge its quality by
+#define PULSE_QUALITY_MIN_RANGE 30 // flatter than this and there's probably no finger on the sensor
+#define PULSE_QUALITY_MIN_VARIANCE 100 // same as above, but robust to the odd spike
+#define PULSE_QUALITY_MAX_RANGE 900 // wilder than this and it's probably motion
+#define PULSE_QUALITY_CLIP_LOW 0 // samples at or past these are clipped by the ADC
+#define PULSE_QUALITY_CLIP_HIGH 1023
+#define PULSE_QUALITY_MAX_CLIPPED 10 // percent of the window's samples
+#define PULSE_QUALITY_RESET_MS 2000 // a bad signal for longer than this starts the peaks over
+#define PULSE_ORDER_BIN_MS (1000/PULSE_SAMPLE_RATE) // resolution of the median/MAD widths, peak times can't be any finer anyway
+#define PULSE_ORDER_BINS 320 // widths past PULSE_ORDER_BINS*PULSE_ORDER_BIN_MS (8s) are lumped into the last bin
+#define PULSE_HR_BOUND_QUANTILE 0.05 // hr_lb and hr_ub are the 5th and 95th percentile of the beat to beat hr
+#define PULSE_HR_QUANTILE_DELTAS 64 // the bounds are from the last 64 deltas
+#define PULSE_SNAPSHOT_VERSION 11
+#define PULSE_MAX_RESTORE_GAP_MS 5000 // older snapshots are too stale to resume from
+// return codes for PulseTrackerInternals::restore
+#define PULSE_RESTORE_OK 0
+#define PULSE_RESTORE_TRUNCATED -1 // ran out of bytes
+#define PULSE_RESTORE_MISMATCH -2 // different version, compiled with different buffer sizes, or different params
+#define PULSE_RESTORE_STALE -3 // the gap is more than PULSE_MAX_RESTORE_GAP_MS
+#define PULSE_RESTORE_CORRUPT -4 // the checksum doesn't match, or the saved heads are out of range
 
 struct HeartRate {
   long time; // time of measure, relative to system clock. millisecs
   float hr; // heart rate
   float hr_lb; // lower bound
   float hr_ub; // upper bound
+  bool provisional; // true if calculated from peaks with provisional stats, so less reliable
+  // heart rate variability (ms, ms, %) over the last HRV_WINDOW_MS, -1 if there's no
+  // HeartRateVariability attached or it has less than HRV_MIN_BEATS intervals
+  float rmssd, sdnn, pnn50;
   char err[40]; // error message, empty string if no error.
 };
 
@@ -31,15 +64,19 @@ struct Peak {
   // width (next peak's time - previous peak's time) and
   // average and standard deviation of the width in relation to nearby (within ~PULSE_VALIDATION_WINDOW_MS/2) peaks.
   // if havent yet been calculated, they will be equal to -1
-  float w, avg, std;
+  pfloat w, avg, std;
+  // median and median absolute deviation of the same widths, only calculated with robust_inspection
+  pfloat med, mad;
   char val; //validation state:
     // '_' = unvalidated
     // '?' = potentially a false pulse
     // 'f' = definitely a false pulse
     // 'v' = valid pulse
-  float d; // delta (time till the next valid pulse)
+  pfloat d; // delta (time till the next valid pulse)
 };
 
+class HeartRateHistory;
+class HeartRateVariability;
 template <typename T> class RingBuffer;
 template <typename T> class RBStream;
 
@@ -57,15 +94,14 @@ class SyncedIndex {
       i = other.i;
     }
   public:
-    SyncedIndex(int i, int buf_cap) : buf_cap(buf_cap) {
-      i = i;
-    }
+    SyncedIndex(int i, int buf_cap) : i(i), buf_cap(buf_cap) {}
     void set_before_increment(std::function<void()> f) {
       before_increment = f;
     }
     SyncedIndex& operator++() {
       if (before_increment != nullptr)
         before_increment();
+      OPCOUNT(imod);
       i = (i+1)%buf_cap;
       return *this;
     }
@@ -199,12 +235,14 @@ class RingBuffer {
     }
     ~RingBuffer() = default;
     T& operator[]( const int i ) const {
+      OPCOUNT(imod);
       return buffer[(h+i)%cap];
     }
     T& operator[]( const SyncedIndex<T>& idx ) const {
       return buffer[idx.i];
     }
     T& push_back() {
+      OPCOUNT(imod);
       T& ret = buffer[(h+len)%cap];
       if (len == cap) {
         h++;
@@ -215,10 +253,24 @@ class RingBuffer {
       return ret;
     }
     T& back() {
+      OPCOUNT(imod);
       return buffer[(h+len-1)%cap];
     }
     int size() const { return len; }
     int capacity() const { return cap; }
+    // where the i'th element lives in the underlying buffer
+    int physical(int i) const { OPCOUNT(imod); return (h+i)%cap; }
+    // drops the oldest element without calling on_advance
+    void pop_front() {
+      OPCOUNT(imod);
+      h = (h+1)%cap;
+      len--;
+    }
+    // empties the buffer without calling on_advance
+    void clear() {
+      h = 0;
+      len = 0;
+    }
     bool full() const { return len==cap; }
     RBStream<T>* new_stream(int heads) {
       streams.push_back(std::make_unique<RBStream<T>>(this, heads));
@@ -250,113 +302,189 @@ class SumStream : BalancedStream<T> {
     }
 };
 
+// Aggregates of the valid (>= 0) widths and deltas of a range of peaks.
+// Widths and deltas are whole milliseconds, so these are exact.
+struct PeakRange {
+  long long w, w2, d, d2; // sums of the widths, their squares, the deltas and their squares
+  int w_count, d_count;
+  long w_min, w_max, d_min, d_max; // only meaningful when the counts are non-zero
+  static PeakRange of(const Peak& p);
+  static PeakRange empty();
+  PeakRange operator+(const PeakRange& o) const;
+  // population variance of the widths/deltas, computed from the exact sums
+  pfloat w_var() const;
+  pfloat d_var() const;
+};
+
+// A sliding window of values (in peak order) that can answer order statistics.
+// Values are binned to PULSE_ORDER_BIN_MS, and counted in a Fenwick tree over the bins,
+// so adding, removing and finding the k'th smallest are O(log bins), with no allocation after construction.
+class OrderStatWindow {
+  private:
+    // fenwick tree of counts per bin, 1 indexed
+    std::unique_ptr<uint16_t[]> counts;
+    // the bins of the values in the window, oldest first
+    std::unique_ptr<uint16_t[]> fifo;
+    const int cap;
+    int h = 0, len = 0;
+    int log_bins;
+    void add(int bin, int delta);
+    // number of values in bins [0, bin]
+    int count_le(int bin) const;
+    // bin of the k'th (0 indexed) smallest value
+    int kth(int k) const;
+  public:
+    OrderStatWindow(int capacity=PULSE_PEAKS_LEN);
+    void push_back(pfloat value);
+    void pop_front();
+    void pop_back();
+    void clear();
+    int size() const { return len; }
+    int capacity() const { return cap; }
+    pfloat median() const;
+    // median of the absolute deviations from the median, O(log^2 bins)
+    pfloat mad() const;
+};
+
+// Exact lower and upper quantiles of the last PULSE_HR_QUANTILE_DELTAS values, which are whole ms
+// (clamped to 0..65535). The values are kept both in arrival order, to know which one to drop, and
+// sorted, so a quantile is a lookup and adding is a binary search and a shift of at most the whole window.
+// Plain data, so it can be copied into a snapshot.
+class WindowedQuantiles {
+  private:
+    uint16_t fifo[PULSE_HR_QUANTILE_DELTAS]; // oldest at h once full
+    uint16_t sorted[PULSE_HR_QUANTILE_DELTAS];
+    pfloat q;
+    int h, len;
+    // nearest rank, -1 if empty
+    pfloat at(pfloat quantile) const;
+  public:
+    WindowedQuantiles(float quantile=PULSE_HR_BOUND_QUANTILE) : q(quantile) { clear(); }
+    void clear();
+    void add(pfloat x);
+    // number of values the quantiles are from
+    int size() const { return len; }
+    pfloat lower() const { return at(q); }
+    pfloat upper() const { return at(1-q); }
+    // false if the window's heads are out of range, like from a corrupt snapshot
+    bool valid() const;
+};
+
 class PeakBuffer : public RingBuffer<Peak> {
   private:
-    struct SumWindow {
-      std::function<float(Peak&)> value;
-      // inclusive
-      int head, tail;
-      int lifetime;
-      float sum;
-    };
+    // Internal nodes of a bottom up segment tree over the physical slots of the buffer.
+    // Node k covers nodes 2k and 2k+1, and node capacity()+i is the leaf for slot i, which
+    // is computed from the peak itself rather than stored.
+    std::unique_ptr<PeakRange[]> tree;
+    PeakRange node(int k) const;
+    PeakRange tree_range(int from, int to) const;
     std::vector<int*> smart_indexes;
-    std::vector<std::unique_ptr<SumWindow>> sum_windows;
-    const std::function<int()> rand_int;
   protected:
     void on_advance(Peak& drop) {
       for (int* si : smart_indexes) {
         (*si)--;
       }
-      for(auto& swp : sum_windows) {
-        auto& sw = *swp;
-        if (sw.tail < 0 && sw.head >= 0) {
-          sw.sum -= sw.value(drop);
-          sw.lifetime--;
-        }
-      }
     }
   public:
-    PeakBuffer(int capacity=PULSE_PEAKS_LEN, std::function<int()> rand_generator=rand)
-      : RingBuffer<Peak>(capacity), rand_int(rand_generator) {}
+    PeakBuffer(int capacity=PULSE_PEAKS_LEN);
+    // same as RingBuffer::push_back, but the peak starts with no width or delta
+    Peak& push_back();
+    // should be called after changing the w or d of the i'th peak, O(log n)
+    void refresh(int i);
+    // should be called after changing the w or d of a lot of peaks, O(n)
+    void refresh_all();
+    // aggregates of the peaks in [start, end), O(log n)
+    PeakRange range(int start, int end) const;
     // TODO: move these function defs to pulse.cpp
     void add_smart_index(int* index) {
       smart_indexes.push_back(index);
     }
-    int register_smart_sum(std::function<float(Peak&)> value) {
-      std::unique_ptr<SumWindow> sw(new SumWindow());
-      sw->head = -1;
-      sw->tail = -1;
-      sw->lifetime = 0;
-      sw->sum = 0;
-      sw->value = value;
-      add_smart_index(&sw->head);
-      add_smart_index(&sw->tail);
-      sum_windows.push_back(std::move(sw));
-      return sum_windows.size()-1;
-    }
-    // key is the return from register_smart_average
-    // start is inclusive
-    // end is exclusive
-    float calc_smart_sum(int key, int start, int end) {
-      if (start == end)
-        return 0;
-      SumWindow& sw = *sum_windows[key];
-      // recalculate when the sum gets too old to account for accumulated floating point errors.
-      if (sw.lifetime <= 0) {
-        // use a pseudo-random lifetime to prevent having to
-        // recalculate all of these at the same time.
-        sw.lifetime = rand_int()%PULSE_MAX_SMART_SUM_AGE;
-        sw.head = end-1;
-        sw.tail = start;
-        sw.sum = 0;
-        for (int i = start; i < end; i++) {
-          sw.sum += sw.value((*this)[i]);
-        }
-        return sw.sum;
-      }
-      // match the tail
-      while(sw.tail < start) {
-        if(sw.tail>=0) {
-          sw.sum -= sw.value((*this)[sw.tail]);
-          sw.lifetime--;
-        }
-        sw.tail++;
-      }
-      while(sw.tail > start) {
-        sw.tail--;
-        sw.sum += sw.value((*this)[sw.tail]);
-        sw.lifetime--;
-      }
-      // match the head
-      int new_head = end-1;
-      while(sw.head > new_head) {
-        sw.sum -= sw.value((*this)[sw.head]);
-        sw.lifetime--;
-        sw.head--;
-      }
-      while(sw.head < new_head) {
-        sw.head++;
-        sw.sum += sw.value((*this)[sw.head]);
-        sw.lifetime--;
-      }
-      return sw.sum;
-    }
+};
+
+// Cheap running stats over the last PULSE_QUALITY_WINDOW_MS of samples to tell if
+// the signal is worth looking for peaks in. The window is by time, so it means the same
+// thing at every sample rate (see SampleRateController).
+class SignalQuality {
+  private:
+    const long window_ms;
+    RingBuffer<int> window;
+    RingBuffer<long> times;
+    long long sum = 0;
+    long long sum2 = 0;
+    int clipped = 0;
+    int min = 0;
+    int max = 0;
+    void rescan_range();
+    // true if the samples span the whole window, like PulseTrackerInternals::slope_window_full
+    bool window_full() const;
+  public:
+    // quality of the signal as of the last push:
+    // '_' = not enough samples yet
+    // 'g' = good
+    // 'f' = flat, probably no finger on the sensor
+    // 'c' = clipped
+    // 'm' = motion
+    char state = '_';
+    SignalQuality(long window_ms=PULSE_QUALITY_WINDOW_MS)
+      : window_ms(window_ms), window((window_ms*PULSE_SAMPLE_RATE+999)/1000+1),
+        times((window_ms*PULSE_SAMPLE_RATE+999)/1000+1) {}
+    // O(1), except when the min or max leaves the window
+    char push(int signal, long time);
+    void clear();
+    int range() const { return max-min; }
+    // variance of the window
+    pfloat variance() const;
+    int clipped_count() const { return clipped; }
+    bool usable() const { return state == 'g' || state == '_'; }
+};
+
+// The tunable parameters of a tracker, which default to the #defines above,
+// so that they can be tuned without recompiling (see sweep.h).
+struct PulseParams {
+  int slope_window_ms = PULSE_SLOPE_WINDOW_MS;
+  long validation_window_ms = PULSE_VALIDATION_WINDOW_MS;
+  float false_pulse_z = PULSE_FALSE_PULSE_Z;
+  float false_pulse_ratio = PULSE_FALSE_PULSE_RATIO;
+  // The most samples a slope window can hold, at the fastest sample rate (PULSE_SAMPLE_RATE).
+  // Rounded up so that windows that aren't a whole number of samples still fill, plus one
+  // for when timer jitter squeezes an extra sample in.
+  int slope_window() const { return (slope_window_ms*PULSE_SAMPLE_RATE+999)/1000+1; }
 };
 
 class PulseTrackerInternals {
   public:
+    const PulseParams params;
     // record samples for long enough to calculate the slope accurately
     RingBuffer<int> pulse_signals;
+    // and the times they were taken, since the sample rate can change (see SampleRateController).
+    // The slope window is params.slope_window_ms long, so it holds fewer samples at lower rates.
+    RingBuffer<long> signal_times;
+    // true if the samples span the whole slope window
+    bool slope_window_full() const;
+    // gates the peak detection on the quality of the signal
+    SignalQuality quality;
+    // set to false to look for peaks no matter the signal quality
+    bool quality_gate = true;
+    // the time the signal went bad, or -1 if it's good
+    long gated_since = -1;
+    // start over with no peaks, as if the tracker was just created
+    void reset_peaks();
     // calculates the slope and max of the current pulse_signals
     // should not be interrupted
-    void slope_and_max(float* slope, int* max_index, int* max_amp);
-    float last_slope = -1;
+    void slope_and_max(pfloat* slope, int* max_index, int* max_amp);
+    pfloat last_slope = -1;
     // check to see if the latest pulse signal caused the slope to switch from
     // increasing to decreasing, and if so, push a peak on the stack
-    bool detect_peak(long now);
+    bool detect_peak();
+    // same as above, but with the slope and max of pulse_signals already calculated
+    bool detect_peak(pfloat slope, int max_index, int max_amp);
 
     PeakBuffer peaks;
     RingBuffer<HeartRate> hr_swap_buf;
+    // if set, every heart rate is also added to this history
+    HeartRateHistory* history = nullptr;
+    // if set, the interval of every valid delta is added to this, and its metrics are published with the heart rate
+    HeartRateVariability* hrv = nullptr;
     // pointers to various bits of work that need to be done on Peaks
     int widths_head = 0; // updated in update_widths
     int stats_head = 0; // updated in peaks.on_advance & update_stats
@@ -365,38 +493,86 @@ class PulseTrackerInternals {
     int resolution_head = 0; // updated in peaks.on_advance & resolve_questionable
     int resolution_tail = 0; // updated in peaks.on_advance & resolve_questionable
     int deltas_head = 0; // updated in peaks.on_advance & update_deltas
-    // keys for smart sum in peaks
-    int widths_sum, widths2_sum, delta_count, delta_sum, delta2_sum;
+    int hr_tail = 0; // updated in peaks.on_advance & update_hr
+    // Use the median/MAD of the widths to inspect pulses instead of the mean/std, which are
+    // skewed by the very false pulses that are being looked for.
+    bool robust_inspection = false;
+    // the widths of peaks [order_start, order_end) are in order_window, updated in peaks.on_advance & sync_order_window.
+    // Only allocated once robust_inspection needs it, the mean/std inspection has no use for its ~750 bytes.
+    std::unique_ptr<OrderStatWindow> order_window;
+    int order_start = 0;
+    int order_end = 0;
+    // slide order_window to cover the widths of peaks [start, end)
+    void sync_order_window(int start, int end);
+    // sets the avg/std (and med/mad with robust_inspection) of the stats_head peak from the widths of [start, end)
+    void set_stats(int start, int end);
+    // While warming up, peaks get provisional stats from however many widths there are, instead
+    // of waiting for a whole validation window. Set to false to always wait for the whole window.
+    bool warming_up = true;
+    // the first peak that got stats from a whole validation window, updated in peaks.on_advance
+    int full_stats_start = 0;
+    // the time of the first peak whose provisional window was a whole validation window long,
+    // after which the windows slide towards being centered, -1 before then
+    long centering_since = -1;
     // four resonably complex clean-up steps that are split up because
     // they operate at different points on the peak buffer, and should be
     // separately tested
     // The ones with boolean returns should be repeated until they return false;
     void update_widths();
     bool update_stats();
+    // the warm up part of update_stats, stats over a growing window
+    bool update_provisional_stats();
     bool inspect_pulse();
     bool resolve_questionable();
     bool update_deltas();
     void update_hr();
+    // quantiles of the valid deltas, fed by update_deltas, for hr_lb and hr_ub
+    WindowedQuantiles delta_quantiles;
 
     // Fast func to push a signal onto the buffer. Not safe to be interrupted.
     // Also calls all of the above update functions so that get_heartrate has
     // as little work to do as possible.
+    // Same as push_signal, then slope_and_max and push_slope when push_signal returns true.
     void push(int pulse_signal, long time);
+    // The first half of push: the signal quality and the slope window.
+    // Returns true if the slope window is full, and the slope should be looked at.
+    bool push_signal(int pulse_signal, long time);
+    // The second half of push: looks for a peak given the slope and max of the slope window,
+    // and processes it. Trackers with the same slope window can share the slope this way.
+    void push_slope(pfloat slope, int max_index, int max_amp);
     // Safe to be interrupted
     void get_heartrate(HeartRate* out) const;
+    // the time of the last pushed signal, -1 if nothing has been pushed yet
+    long last_time = -1;
+
+    // Serializes everything needed to pick up where the tracker left off
+    // (signals, peaks, stage heads, quantiles, the last heart rate) so that a reboot doesn't
+    // have to wait out a whole validation window before producing stats again.
+    // Ends with a CRC-32 of the rest, so a snapshot damaged in flash gets rejected.
+    // Returns the number of bytes written, or -1 if it doesn't fit in cap bytes.
+    // Should not be interrupted.
+    int snapshot(char* out, int cap) const;
+    // Restores a snapshot into this tracker, as if the pushes had continued on
+    // without it. now is the current time and gap_ms is how long it's been since
+    // the snapshot's last push, and all of the saved times are shifted so that
+    // they line up with the current clock (millis() restarts at 0 after a reboot).
+    // Returns one of the PULSE_RESTORE_* codes, and leaves the tracker
+    // untouched unless it's PULSE_RESTORE_OK.
+    int restore(const char* in, int n, long now, long gap_ms);
 
-    PulseTrackerInternals() : pulse_signals(PULSE_SLOPE_WINDOW), hr_swap_buf(2) {
+    PulseTrackerInternals(const PulseParams& params=PulseParams())
+        : params(params), pulse_signals(params.slope_window()), signal_times(params.slope_window()),
+          quality(), hr_swap_buf(2) {
       peaks.add_smart_index(&stats_head);
       peaks.add_smart_index(&stats_tail);
       peaks.add_smart_index(&inspection_head);
       peaks.add_smart_index(&resolution_head);
       peaks.add_smart_index(&resolution_tail);
       peaks.add_smart_index(&deltas_head);
-      widths_sum = peaks.register_smart_sum([](Peak& p){return p.w;});
-      widths2_sum = peaks.register_smart_sum([](Peak& p){return p.w*p.w;});
-      delta_count = peaks.register_smart_sum([](Peak& p){return p.d<0?0:1;});
-      delta_sum = peaks.register_smart_sum([](Peak& p){return p.d<0?0:p.d;});
-      delta2_sum = peaks.register_smart_sum([](Peak& p){return p.d<0?0:p.d*p.d;});
+      peaks.add_smart_index(&hr_tail);
+      peaks.add_smart_index(&full_stats_start);
+      peaks.add_smart_index(&order_start);
+      peaks.add_smart_index(&order_end);
     }
 };
 
@@ -405,10 +581,18 @@ class PulseTracker {
   private:
     PulseTrackerInternals internals;
   public:
+    PulseTracker(const PulseParams& params=PulseParams()) : internals(params) {}
     // Fast func to push a signal onto the buffer. Not safe to be interrupted.
     void push(int pulse_signal, long time) { internals.push(pulse_signal, time); };
     // Safe to be interrupted
     void get_heartrate(HeartRate* out) const { internals.get_heartrate(out); };
+    // keep a long term history of the heart rates, nullptr to stop
+    void set_history(HeartRateHistory* history) { internals.history = history; };
+    // track the heart rate variability, nullptr to stop
+    void set_hrv(HeartRateVariability* hrv) { internals.hrv = hrv; };
+    // see PulseTrackerInternals::snapshot and PulseTrackerInternals::restore
+    int snapshot(char* out, int cap) const { return internals.snapshot(out, cap); };
+    int restore(const char* in, int n, long now, long gap_ms) { return internals.restore(in, n, now, gap_ms); };
 };
 
 #endif
\ No newline at end of file
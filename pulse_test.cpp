@@ -1,7 +1,15 @@
 #include "pulse_test.h"
+#include "hrhistory.h"
+#include "hrv.h"
 #include <cstdio>
 #include <vector>
 #include <algorithm>
+#include <cstring>
+#include <math.h>
+#include <memory>
+
+// snapshots are about 3KB on the ESP8266, and bigger where longs are 8 bytes
+#define PULSE_TEST_SNAPSHOT_BYTES (1024*(int)sizeof(long))
 
 #define ASSERT(t, msg, ...) if(!(t)){char l[128];sprintf(l, msg __VA_OPT__(,) __VA_ARGS__);Serial.println(l);return false;}
 #define ASSERT_CONT(ac, t, msg, ...) if(!(t)){char l[128];sprintf(l, msg __VA_OPT__(,) __VA_ARGS__);Serial.println(l);ac = false;}
@@ -49,9 +57,7 @@ bool test_stream() {
 
 bool test_peak_buffer() {
   Serial.println("Testing PeakBuffer...");
-  PeakBuffer buf(5, []{
-    return 5; // chosen by a fair dice throw, guaranteed to be random
-  });
+  PeakBuffer buf(5);
   int indirect;
   buf.add_smart_index(&indirect);
   buf.push_back().t = -2;
@@ -61,29 +67,90 @@ bool test_peak_buffer() {
   for(int i = 0; i < 4; i++)
     buf.push_back().t = i;
   ASSERT(buf[indirect].t == -3, "Indirect smart index (%d) not tracking value", indirect);
+  return true;
+}
 
-  int time_sum = buf.register_smart_sum([](Peak& p){return p.t;});
-  for(int i = 0; i < buf.capacity(); i++)
-    buf.push_back().t = i;
-
-  float sum = buf.calc_smart_sum(time_sum, 0, 5);
-  ASSERT(sum == 10, "Smart sum of {0,1,2,3,4} != 10");
-  // run out the lifetime of the average to force a recalc
-  for(int i = 0; i < 10; i++) {
-    int end = 1+i%4;
-    float exp_sum = end*(end-1)/2;
-    sum = buf.calc_smart_sum(time_sum, 0, end);
-    ASSERT(sum == exp_sum, "Smart avg from [0,%d) = %f and not %f", end, sum, exp_sum);
+bool test_peak_ranges() {
+  Serial.println("Testing PeakBuffer ranges...");
+  PeakBuffer buf(13);
+  unsigned int seed = 3;
+  for (int n = 0; n < 40; n++) {
+    Peak& p = buf.push_back();
+    seed = seed*1103515245+12345;
+    p.w = (seed>>16)%5 == 0 ? -1 : (int)((seed>>16)%3000);
+    seed = seed*1103515245+12345;
+    p.d = (seed>>16)%4 == 0 ? -1 : (int)((seed>>16)%2000);
+    buf.refresh(buf.size()-1);
+    // check every range against brute force, including ones that wrap around the buffer
+    for (int start = 0; start <= buf.size(); start++) {
+      for (int end = start; end <= buf.size(); end++) {
+        PeakRange r = buf.range(start, end);
+        long long w = 0, w2 = 0, d = 0, d2 = 0;
+        int w_count = 0, d_count = 0;
+        long w_max = -1, d_min = 1000000;
+        for (int i = start; i < end; i++) {
+          long pw = buf[i].w;
+          long pd = buf[i].d;
+          if (pw >= 0) {
+            w += pw;
+            w2 += (long long)pw*pw;
+            w_count++;
+            w_max = pw > w_max ? pw : w_max;
+          }
+          if (pd >= 0) {
+            d += pd;
+            d2 += (long long)pd*pd;
+            d_count++;
+            d_min = pd < d_min ? pd : d_min;
+          }
+        }
+        ASSERT(r.w == w && r.w2 == w2 && r.w_count == w_count, "Width sums of [%d, %d) don't match", start, end);
+        ASSERT(r.d == d && r.d2 == d2 && r.d_count == d_count, "Delta sums of [%d, %d) don't match", start, end);
+        ASSERT(w_count == 0 || r.w_max == w_max, "Max width of [%d, %d) is %ld and not %ld", start, end, r.w_max, w_max);
+        ASSERT(d_count == 0 || r.d_min == d_min, "Min delta of [%d, %d) is %ld and not %ld", start, end, r.d_min, d_min);
+      }
+    }
   }
+  // variance from exact sums shouldn't suffer from cancellation
+  PeakBuffer flat(5);
+  for (int i = 0; i < 5; i++) {
+    flat.push_back().w = 100000+(i%2);
+    flat.refresh(i);
+  }
+  float var = flat.range(0, 5).w_var();
+  ASSERT(abs(var-0.24) < 0.001, "Variance of {100000, 100001, ...} = %f and not 0.24", var);
+  return true;
+}
 
-  // check that the avg window stay's updated with buffer overflows
-  sum = buf.calc_smart_sum(time_sum, 0, 5);
-  ASSERT(sum == 10, "Smart sum of {0,1,2,3,4} != 10");
-  buf.push_back().t = 5;
-  buf.push_back().t = 6;
-  sum = buf.calc_smart_sum(time_sum, 0, 5);
-  ASSERT(sum == 20, "Smart sum of {2,3,4,5,6} != 20");
-
+bool bench_peak_ranges() {
+  Serial.println("Benchmarking PeakBuffer ranges vs summing the peaks...");
+  const int iters = 10000;
+  PeakBuffer buf;
+  for (int i = 0; i < buf.capacity(); i++) {
+    buf.push_back().w = 800+i%50;
+    buf.refresh(i);
+  }
+  // two stages asking for different windows
+  int n = buf.capacity();
+  volatile long long total = 0;
+  unsigned long start = micros();
+  for (int i = 0; i < iters; i++) {
+    long long w = 0;
+    for (int j = i%2 ? 0 : n/2; j < (i%2 ? n/2 : n); j++)
+      w += (long)buf[j].w;
+    total = total+w;
+  }
+  unsigned long loop_us = micros()-start;
+  volatile long long tree_total = 0;
+  start = micros();
+  for (int i = 0; i < iters; i++)
+    tree_total = tree_total+buf.range(i%2 ? 0 : n/2, i%2 ? n/2 : n).w;
+  unsigned long tree_us = micros()-start;
+  char l[128];
+  sprintf(l, "  alternating windows, loop: %.3fus/query, range tree: %.3fus/query",
+    (float)loop_us/iters, (float)tree_us/iters);
+  Serial.println(l);
+  ASSERT(total == tree_total, "Summing the peaks and the range tree disagree");
   return true;
 }
 
@@ -91,9 +158,12 @@ bool test_peak_detection() {
   Serial.println("Testing peak detection...");
   PulseTrackerInternals tracker;
 
+  double frame_duration = 1000.0/PULSE_SAMPLE_RATE;
   // just fill up the buffer so we can set it manually
-  while(!tracker.pulse_signals.full())
+  while(!tracker.pulse_signals.full()) {
+    tracker.signal_times.push_back() = frame_duration*tracker.pulse_signals.size();
     tracker.pulse_signals.push_back() = 0;
+  }
 
   // init with a peak at PULSE_SLOPE_WINDOW/2-1
   tracker.last_slope = 1;
@@ -104,11 +174,9 @@ bool test_peak_detection() {
     tracker.pulse_signals[expected_max_i-i] = expected_max-i;
   for(int i = 0; i+expected_max_i < tracker.pulse_signals.size(); i++)
     tracker.pulse_signals[i+expected_max_i] = expected_max-2*i;
-  double frame_duration = 1000.0/PULSE_SAMPLE_RATE;
-  double current_time = frame_duration*(tracker.pulse_signals.size()-1);
   double expected_max_time = frame_duration*expected_max_i;
 
-  ASSERT(tracker.detect_peak(current_time), "Peak not detected.");
+  ASSERT(tracker.detect_peak(), "Peak not detected.");
 
   ASSERT(tracker.peaks.size()==1, "peaks.size() != 1");
   double time_err = abs(tracker.peaks[0].t-expected_max_time);
@@ -157,11 +225,11 @@ bool test_update_peak_stats() {
     num_avgs++;
     if (num_avgs <= 2) {
       // The first two stats are a little fuzzy cus the first peaks have 0 widths
-      ASSERT(abs(tracker.peaks[i].avg-2000)<250, "peak[%d].avg = %f, and not near-ish 2000", i, tracker.peaks[i].avg);
-      ASSERT(tracker.peaks[i].std<1000, "peak[%d].std = %f, and not < 1000", i, tracker.peaks[i].std);
+      ASSERT(abs(tracker.peaks[i].avg-2000)<250, "peak[%d].avg = %f, and not near-ish 2000", i, (float)tracker.peaks[i].avg);
+      ASSERT(tracker.peaks[i].std<1000, "peak[%d].std = %f, and not < 1000", i, (float)tracker.peaks[i].std);
     } else {
-      ASSERT(tracker.peaks[i].avg == 2000, "peak[%d].avg = %f, and not 2000", i, tracker.peaks[i].avg);
-      ASSERT(tracker.peaks[i].std == 0, "peak[%d].std = %f, and not 0", i, tracker.peaks[i].std);
+      ASSERT(tracker.peaks[i].avg == 2000, "peak[%d].avg = %f, and not 2000", i, (float)tracker.peaks[i].avg);
+      ASSERT(tracker.peaks[i].std == 0, "peak[%d].std = %f, and not 0", i, (float)tracker.peaks[i].std);
     }
   }
 
@@ -218,6 +286,121 @@ bool test_inspect_pulses() {
   return true;
 }
 
+bool test_order_stat_window() {
+  Serial.println("Testing OrderStatWindow...");
+  OrderStatWindow window(20);
+  std::vector<int> bins;
+  unsigned int seed = 11;
+  for (int i = 0; i < 300; i++) {
+    seed = seed*1103515245+12345;
+    int bin = 30+(seed>>16)%50;
+    // slide forward most of the time, sometimes shrink from the back
+    if (i%7 == 3 && !bins.empty()) {
+      window.pop_back();
+      bins.pop_back();
+    } else {
+      window.push_back(bin*PULSE_ORDER_BIN_MS);
+      bins.push_back(bin);
+      if ((int)bins.size() > window.capacity())
+        bins.erase(bins.begin());
+    }
+    if (i%5 == 0 && bins.size() > 1) {
+      window.pop_front();
+      bins.erase(bins.begin());
+    }
+    ASSERT(window.size() == (int)bins.size(), "size = %d and not %d", window.size(), (int)bins.size());
+    std::vector<int> sorted(bins);
+    std::sort(sorted.begin(), sorted.end());
+    int n = sorted.size();
+    float med = (sorted[(n-1)/2]+sorted[n/2])*PULSE_ORDER_BIN_MS/2.0;
+    ASSERT(window.median() == med, "median = %f and not %f", (float)window.median(), med);
+    std::vector<int> devs;
+    for (int b : sorted)
+      devs.push_back(abs(b-sorted[(n-1)/2]));
+    std::sort(devs.begin(), devs.end());
+    float mad = devs[(n+1)/2-1]*PULSE_ORDER_BIN_MS;
+    ASSERT(window.mad() == mad, "mad = %f and not %f", (float)window.mad(), mad);
+  }
+  return true;
+}
+
+// true beats every ~850ms, with false pulses (lower amplitude) between a fraction of them.
+// Reports how many false pulses end up marked 'f', and how many real ones do too.
+void inspect_accuracy(bool robust, float false_rate, int* caught, int* n_false, int* wrong, int* n_real, float* us_per_peak) {
+  PulseTrackerInternals tracker;
+  tracker.robust_inspection = robust;
+  tracker.warming_up = false;
+  unsigned int seed = 5;
+  (*caught) = (*n_false) = (*wrong) = (*n_real) = 0;
+  unsigned long elapsed = 0;
+  long t = 0;
+  for (int beat = 0; beat < 2000; beat++) {
+    seed = seed*1103515245+12345;
+    long interval = 800+(seed>>16)%100;
+    seed = seed*1103515245+12345;
+    bool add_false = (seed>>16)%1000 < false_rate*1000;
+    for (int k = 0; k < (add_false ? 2 : 1); k++) {
+      if (tracker.peaks.full()) {
+        // count up the peak that's about to be dropped
+        Peak& old = tracker.peaks[0];
+        if (old.val == 'v' || old.val == 'f') {
+          bool real = old.amp >= 80;
+          (*n_real) += real;
+          (*n_false) += !real;
+          if (real && old.val == 'f')
+            (*wrong)++;
+          if (!real && old.val == 'f')
+            (*caught)++;
+        }
+      }
+      Peak& p = tracker.peaks.push_back();
+      seed = seed*1103515245+12345;
+      p.t = k == 0 ? t : t+interval*(3+(seed>>16)%4)/10;
+      p.amp = (k == 0 ? 100 : 40)+(seed>>16)%10;
+      p.avg = -1;
+      p.std = -1;
+      p.val = '_';
+      unsigned long start = micros();
+      tracker.update_widths();
+      while(tracker.update_stats());
+      while(tracker.inspect_pulse());
+      while(tracker.resolve_questionable());
+      elapsed += micros()-start;
+    }
+    t += interval;
+  }
+  (*us_per_peak) = (float)elapsed/(2000*(1+false_rate));
+}
+
+bool test_robust_inspection() {
+  Serial.println("Testing robust inspection...");
+  int caught, n_false, wrong, n_real;
+  float us;
+  inspect_accuracy(true, 0.05, &caught, &n_false, &wrong, &n_real, &us);
+  ASSERT(n_false > 0 && caught >= n_false*9/10, "Only caught %d of %d false pulses", caught, n_false);
+  ASSERT(wrong <= n_real/100, "Marked %d of %d real pulses false", wrong, n_real);
+  return true;
+}
+
+bool bench_robust_inspection() {
+  Serial.println("Benchmarking mean/std vs median/MAD inspection...");
+  Serial.println("  false rate | mean/std: caught    wrong  us/peak | median/MAD: caught    wrong  us/peak");
+  const float rates[] = {0.05, 0.15, 0.3, 0.45};
+  char l[128];
+  for (float rate : rates) {
+    int caught[2], n_false[2], wrong[2], n_real[2];
+    float us[2];
+    for (int robust = 0; robust < 2; robust++)
+      inspect_accuracy(robust, rate, &caught[robust], &n_false[robust], &wrong[robust], &n_real[robust], &us[robust]);
+    sprintf(l, "  %9.0f%% |        %6.1f%%  %6.1f%%  %7.3f |          %6.1f%%  %6.1f%%  %7.3f",
+      rate*100,
+      100.0*caught[0]/n_false[0], 100.0*wrong[0]/n_real[0], us[0],
+      100.0*caught[1]/n_false[1], 100.0*wrong[1]/n_real[1], us[1]);
+    Serial.println(l);
+  }
+  return true;
+}
+
 bool test_resolve_questionable() {
   Serial.println("Testing resovle_questionable...");
   
@@ -245,17 +428,653 @@ bool test_resolve_questionable() {
   return ac;
 }
 
+// a clean, roughly pulse shaped signal at the given bpm
+int synthetic_pulse(long t, float bpm) {
+  float phase = fmod(t*bpm/60000.0, 1.0);
+  // sharp systolic rise, slower decay
+  float v = phase < 0.15 ? phase/0.15 : exp(-(phase-0.15)*4);
+  return 300+(int)(400*v);
+}
+
+// synthetic_pulse with a dicrotic bump (which causes false peaks) and some noise
+int noisy_pulse(long t, float bpm, unsigned int* seed) {
+  (*seed) = (*seed)*1103515245+12345;
+  float phase = fmod(t*bpm/60000.0, 1.0);
+  float notch = phase > 0.45 && phase < 0.65 ? 90*sin((phase-0.45)*M_PI/0.2) : 0;
+  return synthetic_pulse(t, bpm)+(int)notch+(int)(((*seed)>>16)%31)-15;
+}
+
+// what the sensor reads with no finger on it, a bit of noise around a constant
+int off_finger(float level, unsigned int* seed) {
+  (*seed) = (*seed)*1103515245+12345;
+  int v = (int)level+(int)(((*seed)>>16)%11)-5;
+  return v < 0 ? 0 : (v > 1023 ? 1023 : v);
+}
+
+bool test_slope_window_lengths() {
+  Serial.println("Testing slope windows that aren't a whole number of samples...");
+  const int windows_ms[] = {200, 225, 240, 249};
+  const int rates[] = {PULSE_SAMPLE_RATE, PULSE_SAMPLE_RATE/2};
+  for (int w : windows_ms) {
+    for (int rate : rates) {
+      PulseParams params;
+      params.slope_window_ms = w;
+      PulseTrackerInternals tracker(params);
+      HeartRate hr;
+      bool filled = false;
+      for (long t = 0; t < 30000; t += 1000/rate) {
+        tracker.push(synthetic_pulse(t, 72), t);
+        filled = filled || tracker.slope_window_full();
+      }
+      tracker.get_heartrate(&hr);
+      ASSERT(filled, "A %dms slope window never filled at %dHz", w, rate);
+      ASSERT(hr.err[0] == 0 && abs(hr.hr-72) < 1, "%dms slope window at %dHz: hr = %f (%s)", w, rate, hr.hr, hr.err);
+    }
+  }
+  return true;
+}
+
+bool test_lazy_order_window() {
+  Serial.println("Testing the order window is only allocated for robust inspection...");
+  PulseTrackerInternals tracker;
+  for (long t = 0; t < 30000; t += 1000/PULSE_SAMPLE_RATE)
+    tracker.push(synthetic_pulse(t, 72), t);
+  ASSERT(!tracker.order_window, "Allocated an order window without robust inspection");
+  tracker.robust_inspection = true;
+  for (long t = 30000; t < 45000; t += 1000/PULSE_SAMPLE_RATE)
+    tracker.push(synthetic_pulse(t, 72), t);
+  ASSERT(tracker.order_window && tracker.peaks[tracker.stats_head-1].med > 0, "No medians after turning on robust inspection");
+  return true;
+}
+
+bool peaks_match(PulseTrackerInternals& a, PulseTrackerInternals& b, long shift) {
+  if (a.peaks.size() != b.peaks.size())
+    return false;
+  for (int i = 0; i < a.peaks.size(); i++) {
+    Peak& pa = a.peaks[i];
+    Peak& pb = b.peaks[i];
+    if (pa.t+shift != pb.t || pa.amp != pb.amp || pa.w != pb.w || pa.avg != pb.avg
+        || pa.std != pb.std || pa.val != pb.val || pa.d != pb.d)
+      return false;
+  }
+  return true;
+}
+
+bool test_snapshot_restore() {
+  Serial.println("Testing tracker snapshot/restore...");
+  const long dt = 1000/PULSE_SAMPLE_RATE;
+  PulseTrackerInternals a;
+  long t = 0;
+  for (; t < 60000; t += dt)
+    a.push(synthetic_pulse(t, 72), t);
+  ASSERT(a.stats_head > 0, "No stats to snapshot");
+
+  std::unique_ptr<char[]> buf(new char[PULSE_TEST_SNAPSHOT_BYTES]);
+  char* snap = buf.get();
+  int n = a.snapshot(snap, PULSE_TEST_SNAPSHOT_BYTES);
+  ASSERT(n > 0, "Snapshot didn't fit in %d bytes", PULSE_TEST_SNAPSHOT_BYTES);
+  ASSERT(a.snapshot(snap, n-1) == -1, "Snapshot should fail with too little room");
+  n = a.snapshot(snap, PULSE_TEST_SNAPSHOT_BYTES);
+
+  // restoring with no gap should continue exactly like the original
+  PulseTrackerInternals b;
+  int r = b.restore(snap, n, a.last_time, 0);
+  ASSERT(r == PULSE_RESTORE_OK, "Restore failed with %d", r);
+  ASSERT(peaks_match(a, b, 0), "Restored peaks don't match");
+  for (long t2 = t; t2 < t+30000; t2 += dt) {
+    int signal = synthetic_pulse(t2, 72);
+    a.push(signal, t2);
+    b.push(signal, t2);
+  }
+  ASSERT(peaks_match(a, b, 0), "Peaks diverged after restore");
+  ASSERT(a.stats_head == b.stats_head && a.resolution_head == b.resolution_head,
+    "Heads diverged after restore");
+
+  // restore after a reboot, where the clock starts over
+  PulseTrackerInternals c;
+  long gap = 1500;
+  long now = 800;
+  long shift = now-gap-a.last_time;
+  n = a.snapshot(snap, PULSE_TEST_SNAPSHOT_BYTES);
+  ASSERT(n > 0, "Snapshot didn't fit in %d bytes", PULSE_TEST_SNAPSHOT_BYTES);
+  r = c.restore(snap, n, now, gap);
+  ASSERT(r == PULSE_RESTORE_OK, "Restore after reboot failed with %d", r);
+  ASSERT(peaks_match(a, c, shift), "Peak times weren't shifted to the new clock");
+  ASSERT(c.pulse_signals.size() == 0, "Signals from before the gap weren't dropped");
+  // the last heart rate comes along, so there's one before the next beat
+  HeartRate before, after;
+  a.get_heartrate(&before);
+  c.get_heartrate(&after);
+  ASSERT(after.err[0] == 0 && after.hr == before.hr && after.time == before.time+shift,
+    "Restored hr = %f at %ld (%s), not %f at %ld", after.hr, after.time, after.err, before.hr, before.time+shift);
+  // the next peaks should get stats right away instead of after a whole validation window
+  int stats_head = c.stats_head;
+  for (long t2 = now; t2 < now+PULSE_VALIDATION_WINDOW_MS/4; t2 += dt)
+    c.push(synthetic_pulse(t2, 72), t2);
+  ASSERT(c.stats_head > stats_head, "Restored tracker didn't produce stats");
+
+  // bad snapshots should leave the tracker alone
+  PulseTrackerInternals d;
+  ASSERT(d.restore(snap, n, now, PULSE_MAX_RESTORE_GAP_MS+1) == PULSE_RESTORE_STALE, "Stale snapshot accepted");
+  ASSERT(d.restore(snap, n-1, now, gap) == PULSE_RESTORE_TRUNCATED, "Truncated snapshot accepted");
+  // a flipped bit anywhere past the header, like a worn out flash page
+  snap[n/2] ^= 0x10;
+  ASSERT(d.restore(snap, n, now, gap) == PULSE_RESTORE_CORRUPT, "Corrupt snapshot accepted");
+  snap[n/2] ^= 0x10;
+  snap[1]++;
+  ASSERT(d.restore(snap, n, now, gap) == PULSE_RESTORE_MISMATCH, "Mismatched version accepted");
+  ASSERT(d.peaks.size() == 0 && d.last_time == -1, "Failed restore changed the tracker");
+
+  // at a lower sample rate, a gap of one sample is longer, but still not a gap
+  const long slow_dt = 2*dt;
+  PulseTrackerInternals e;
+  for (t = 0; t < 60000; t += slow_dt)
+    e.push(synthetic_pulse(t, 72), t);
+  n = e.snapshot(snap, PULSE_TEST_SNAPSHOT_BYTES);
+  PulseTrackerInternals f;
+  r = f.restore(snap, n, e.last_time+slow_dt, slow_dt);
+  ASSERT(r == PULSE_RESTORE_OK, "Restore at half rate failed with %d", r);
+  ASSERT(f.pulse_signals.size() == e.pulse_signals.size() && f.pulse_signals.size() > 0,
+    "Restore at half rate kept %d of %d signals", f.pulse_signals.size(), e.pulse_signals.size());
+  for (long t2 = t; t2 < t+30000; t2 += slow_dt) {
+    int signal = synthetic_pulse(t2, 72);
+    e.push(signal, t2);
+    f.push(signal, t2);
+  }
+  ASSERT(peaks_match(e, f, 0), "Peaks diverged after a restore at half rate");
+  return true;
+}
+
+bool test_heartrate() {
+  Serial.println("Testing heart rate...");
+  const long dt = 1000/PULSE_SAMPLE_RATE;
+  PulseTrackerInternals tracker;
+  HeartRateHistory history;
+  tracker.history = &history;
+  HeartRate hr;
+  tracker.get_heartrate(&hr);
+  ASSERT(hr.hr == -1 && hr.err[0] != 0, "Expected an error before any pulses");
+  for (long t = 0; t < 60000; t += dt)
+    tracker.push(synthetic_pulse(t, 72), t);
+  tracker.get_heartrate(&hr);
+  ASSERT(hr.err[0] == 0, "Heart rate error: %s", hr.err);
+  ASSERT(abs(hr.hr-72) < 1, "hr = %f and not 72", hr.hr);
+  ASSERT(hr.hr_lb <= hr.hr && hr.hr <= hr.hr_ub, "hr %f not within [%f, %f]", hr.hr, hr.hr_lb, hr.hr_ub);
+  ASSERT(!hr.provisional, "hr still provisional after a minute");
+  ASSERT(hr.rmssd == -1 && hr.sdnn == -1 && hr.pnn50 == -1, "HRV published without a HeartRateVariability");
+  HeartRateSummary summary;
+  ASSERT(history.summarize(hr.time, 10000, &summary), "No heart rates in the history");
+  ASSERT(abs(summary.mean-72) < 1, "History mean = %f and not 72", summary.mean);
+  for (int i = tracker.resolution_tail; i < tracker.peaks.size(); i++)
+    ASSERT(tracker.peaks[i].d == -1, "Unresolved peak %d has a delta", i);
+  return true;
+}
+
+bool test_provisional_stats() {
+  Serial.println("Testing provisional stats...");
+  const long dt = 1000/PULSE_SAMPLE_RATE;
+  PulseTrackerInternals tracker;
+  HeartRate hr;
+  long t = 0;
+  for (; t < PULSE_VALIDATION_WINDOW_MS/2; t += dt)
+    tracker.push(synthetic_pulse(t, 72), t);
+  tracker.get_heartrate(&hr);
+  ASSERT(hr.err[0] == 0, "No provisional hr after %ldms: %s", t, hr.err);
+  ASSERT(hr.provisional, "Early hr isn't marked provisional");
+  ASSERT(abs(hr.hr-72) < 3, "Provisional hr = %f and not near 72", hr.hr);
+  ASSERT(tracker.warming_up, "Stopped warming up too soon");
+  float provisional_width = hr.hr_ub-hr.hr_lb;
+
+  // through the switch to full windows the heart rate should keep updating, at worst every
+  // other beat while the window recenters, rather than stalling for half a validation window
+  const long beat = 60000/72;
+  long last_hr_time = hr.time, last_update = t;
+  for (; t < 40000; t += dt) {
+    tracker.push(synthetic_pulse(t, 72), t);
+    tracker.get_heartrate(&hr);
+    ASSERT(hr.err[0] == 0, "Lost the hr at %ldms: %s", t, hr.err);
+    ASSERT(hr.time >= last_hr_time, "hr went back in time at %ldms", t);
+    if (hr.time > last_hr_time) {
+      last_hr_time = hr.time;
+      last_update = t;
+    }
+    ASSERT(t-last_update < 3*beat, "hr hasn't updated for %ldms at %ldms", t-last_update, t);
+    ASSERT(t-hr.time < PULSE_VALIDATION_WINDOW_MS, "hr went stale at %ldms", t);
+  }
+  ASSERT(!tracker.warming_up, "Never finished warming up");
+  ASSERT(!hr.provisional, "hr still provisional after warming up");
+  ASSERT(hr.hr_ub-hr.hr_lb <= provisional_width, "Full window bounds are wider than provisional");
+  ASSERT(abs(hr.hr-72) < 1, "hr = %f and not 72", hr.hr);
+  return true;
+}
+
+// With a dicrotic notch that passes for a peak on most of the first few beats, a few widths
+// can't tell the false pulses, so the provisional hr relies on their amplitudes instead
+bool test_provisional_noisy() {
+  Serial.println("Testing provisional stats on a noisy pulse...");
+  const long dt = 1000/PULSE_SAMPLE_RATE;
+  for (float bpm : {72.0f, 100.0f}) {
+    PulseTrackerInternals tracker;
+    HeartRateHistory history;
+    HeartRateVariability hrv;
+    tracker.history = &history;
+    tracker.hrv = &hrv;
+    HeartRate hr;
+    HeartRateSummary summary;
+    unsigned int seed = 1;
+    long first = -1;
+    bool was_provisional = true;
+    for (long t = 0; t < 40000; t += dt) {
+      tracker.push(noisy_pulse(t, bpm, &seed), t);
+      tracker.get_heartrate(&hr);
+      if (tracker.warming_up) {
+        // nothing provisional should outlive warming up
+        ASSERT(hrv.beats() == 0, "%.0fbpm: provisional deltas went to the HRV at %ldms", bpm, t);
+        ASSERT(!history.summarize(t, t+1, &summary), "%.0fbpm: provisional hr went to the history at %ldms", bpm, t);
+      }
+      if (hr.err[0] != 0)
+        continue;
+      if (first < 0)
+        first = t;
+      if (hr.provisional) {
+        ASSERT(abs(hr.hr-bpm) < 3, "%.0fbpm: provisional hr = %f at %ldms", bpm, hr.hr, t);
+        ASSERT(hr.hr_lb <= bpm && hr.hr_ub >= bpm && hr.hr_ub-hr.hr_lb > 1.99*PULSE_PROVISIONAL_MIN_BOUND*hr.hr,
+          "%.0fbpm: provisional bounds [%f, %f] at %ldms are too narrow", bpm, hr.hr_lb, hr.hr_ub, t);
+      } else if (was_provisional) {
+        // the bounds shouldn't carry the provisional deltas over
+        ASSERT(hr.hr_ub-hr.hr_lb < 0.1*bpm, "%.0fbpm: first full bounds [%f, %f]", bpm, hr.hr_lb, hr.hr_ub);
+      }
+      was_provisional = hr.provisional;
+    }
+    ASSERT(first >= 0 && first < PULSE_VALIDATION_WINDOW_MS/2, "%.0fbpm: first hr at %ldms", bpm, first);
+    ASSERT(!was_provisional, "%.0fbpm: hr still provisional", bpm);
+  }
+  return true;
+}
+
+// exact nearest rank quantile, the same definition WindowedQuantiles uses
+float exact_quantile(std::vector<float> values, float q) {
+  std::sort(values.begin(), values.end());
+  return values[(int)(q*(values.size()-1)+0.5)];
+}
+
+// deltas (ms) drawn from a few differently shaped distributions
+float synthetic_delta(int shape, unsigned int* seed) {
+  float u[4];
+  for (int i = 0; i < (shape == 1 ? 4 : 1); i++) {
+    (*seed) = (*seed)*1103515245+12345;
+    u[i] = ((*seed)>>16)%10000/10000.0;
+  }
+  switch (shape) {
+    case 0: return 600+400*u[0]; // uniform
+    case 1: return 833+40*(u[0]+u[1]+u[2]+u[3]-2)*1.7; // about normal, sd of 40
+    default: return 700-150*log(1-u[0]); // skewed, long tail of slow beats
+  }
+}
+
+bool test_windowed_quantiles() {
+  Serial.println("Testing WindowedQuantiles...");
+  const int n = PULSE_HR_QUANTILE_DELTAS;
+  const float qs[] = {0.05, 0.25, 0.5};
+  for (int shape = 0; shape < 3; shape++) {
+    for (float q : qs) {
+      WindowedQuantiles est(q);
+      ASSERT(est.size() == 0 && est.lower() == -1, "Expected -1 with no values");
+      std::vector<float> values;
+      unsigned int seed = 9+shape;
+      for (int i = 0; i < 6*n; i++) {
+        // the rate jumps up partway through, and the old deltas should be forgotten
+        float x = round(synthetic_delta(shape, &seed))-(i >= 3*n ? 300 : 0);
+        est.add(x);
+        values.push_back(x);
+        ASSERT(est.size() == (i < n ? i+1 : n), "size = %d after %d values", est.size(), i+1);
+        std::vector<float> recent(values.end()-est.size(), values.end());
+        ASSERT(est.lower() == exact_quantile(recent, q), "shape %d after %d: q%.2f = %f and not %f",
+          shape, i+1, q, (float)est.lower(), exact_quantile(recent, q));
+        ASSERT(est.upper() == exact_quantile(recent, 1-q), "shape %d after %d: q%.2f = %f and not %f",
+          shape, i+1, 1-q, (float)est.upper(), exact_quantile(recent, 1-q));
+      }
+    }
+  }
+  // whole ms, clamped to what fits
+  WindowedQuantiles est(0);
+  est.add(-5);
+  est.add(100000);
+  est.add(832.6);
+  ASSERT(est.lower() == 0 && est.upper() == 65535, "Clamped to [%f, %f]", (float)est.lower(), (float)est.upper());
+  est.clear();
+  est.add(832.6);
+  ASSERT(est.lower() == 833, "%f wasn't rounded to 833", (float)est.lower());
+  est.clear();
+  ASSERT(est.size() == 0 && est.lower() == -1, "Not cleared");
+  return true;
+}
+
+bool test_hr_bounds() {
+  Serial.println("Testing heart rate bounds...");
+  PulseTrackerInternals tracker;
+  HeartRateVariability hrv;
+  tracker.hrv = &hrv;
+  // breathing makes the heart rate swing between about 64 and 80bpm
+  float phase = 0;
+  HeartRate hr;
+  for (long t = 0; t < 120000; t += 1000/PULSE_SAMPLE_RATE) {
+    float bpm = 72+8*sin(t*2*M_PI/12000);
+    phase += bpm/(60*PULSE_SAMPLE_RATE);
+    tracker.push(synthetic_pulse(phase*60000/72, 72), t);
+    tracker.get_heartrate(&hr);
+    if (hr.err[0] == 0)
+      ASSERT(hr.hr_lb <= hr.hr && hr.hr <= hr.hr_ub, "hr %f not within [%f, %f] at %ldms", hr.hr, hr.hr_lb, hr.hr_ub, t);
+  }
+  ASSERT(hr.err[0] == 0 && !hr.provisional, "No steady hr: %s", hr.err);
+  // the exact bounds of the deltas the estimators have seen
+  std::vector<float> deltas;
+  for (int i = tracker.deltas_head-1; i >= 0 && (int)deltas.size() < tracker.delta_quantiles.size(); i--) {
+    if (tracker.peaks[i].d >= 0)
+      deltas.push_back(60000.0/tracker.peaks[i].d);
+  }
+  ASSERT((int)deltas.size() == tracker.delta_quantiles.size(), "Only %d deltas left in the peaks", (int)deltas.size());
+  float lb = exact_quantile(deltas, PULSE_HR_BOUND_QUANTILE);
+  float ub = exact_quantile(deltas, 1-PULSE_HR_BOUND_QUANTILE);
+  ASSERT(lb < 68 && ub > 76, "Exact bounds [%f, %f] don't show the swing", lb, ub);
+  ASSERT(abs(hr.hr_lb-lb) < 0.01, "hr_lb = %f and not %f", hr.hr_lb, lb);
+  ASSERT(abs(hr.hr_ub-ub) < 0.01, "hr_ub = %f and not %f", hr.hr_ub, ub);
+  // and the HRV from the same deltas is published along with it
+  ASSERT(hrv.beats() >= HRV_MIN_BEATS, "Only %d intervals in the HRV window", hrv.beats());
+  ASSERT(hr.rmssd == hrv.rmssd() && hr.sdnn == hrv.sdnn() && hr.pnn50 == hrv.pnn50(), "HRV not published");
+  ASSERT(hr.rmssd > 0 && hr.sdnn > 0, "No variability in a swinging heart rate");
+  return true;
+}
+
+bool bench_quantiles() {
+  Serial.println("Benchmarking windowed quantiles vs sorting the window (us per delta)...");
+  const int n = 2000;
+  unsigned int seed = 1;
+  std::vector<float> values;
+  for (int i = 0; i < n; i++)
+    values.push_back(synthetic_delta(2, &seed));
+  volatile float sink = 0;
+
+  WindowedQuantiles est;
+  unsigned long start = micros();
+  for (float x : values) {
+    est.add(x);
+    sink = sink+est.lower()+est.upper();
+  }
+  unsigned long windowed = micros()-start;
+
+  // what it would take to sort the same window each delta
+  start = micros();
+  for (int i = 0; i < n; i++) {
+    int len = i < PULSE_HR_QUANTILE_DELTAS ? i+1 : PULSE_HR_QUANTILE_DELTAS;
+    std::vector<float> window(values.begin()+i+1-len, values.begin()+i+1);
+    std::sort(window.begin(), window.end());
+    sink = sink+window[(int)(PULSE_HR_BOUND_QUANTILE*(len-1)+0.5)]+window[(int)((1-PULSE_HR_BOUND_QUANTILE)*(len-1)+0.5)];
+  }
+  unsigned long sorting = micros()-start;
+
+  char l[128];
+  sprintf(l, "  windowed: %7.3f  sorting: %7.3f  memory: %d bytes",
+    (float)windowed/n, (float)sorting/n, (int)sizeof(WindowedQuantiles));
+  Serial.println(l);
+  return true;
+}
+
+bool test_signal_quality() {
+  Serial.println("Testing signal quality...");
+  const long dt = 1000/PULSE_SAMPLE_RATE;
+  SignalQuality q;
+  unsigned int seed = 7;
+  long qt = 0;
+  for (long end = qt+2000; qt < end; qt += dt)
+    q.push(synthetic_pulse(qt, 72), qt);
+  ASSERT(q.state == 'g', "Clean pulse has quality '%c'", q.state);
+  for (long end = qt+2000; qt < end; qt += dt)
+    q.push(off_finger(500, &seed), qt);
+  ASSERT(q.state == 'f', "Off finger signal has quality '%c'", q.state);
+  ASSERT(q.range() <= 10, "Off finger range = %d", q.range());
+  for (long end = qt+2000; qt < end; qt += dt)
+    q.push(off_finger(1023, &seed), qt);
+  ASSERT(q.state == 'c', "Pegged signal has quality '%c'", q.state);
+  ASSERT(q.clipped_count()*100 > PULSE_QUALITY_MAX_CLIPPED*PULSE_QUALITY_WINDOW_MS/dt, "Only %d clipped", q.clipped_count());
+  for (long end = qt+2000; qt < end; qt += dt)
+    q.push(qt%500 < 250 ? 50 : 1000, qt);
+  ASSERT(q.state == 'm', "Wild signal has quality '%c'", q.state);
+
+  // at a lower sample rate the window still covers the same time, not twice as long
+  SignalQuality slow;
+  const long slow_dt = 2*dt;
+  qt = 0;
+  for (long end = qt+PULSE_QUALITY_WINDOW_MS; qt < end; qt += slow_dt)
+    slow.push(synthetic_pulse(qt, 72), qt);
+  ASSERT(slow.state == 'g', "Clean pulse at half rate has quality '%c' after a window", slow.state);
+  for (long end = qt+PULSE_QUALITY_WINDOW_MS+slow_dt; qt < end; qt += slow_dt)
+    slow.push(off_finger(500, &seed), qt);
+  ASSERT(slow.state == 'f', "Off finger signal at half rate has quality '%c' after a window", slow.state);
+
+  // a tracker should stop finding peaks when the finger is lifted, and start over when it comes back
+  PulseTrackerInternals tracker;
+  HeartRate hr;
+  long t = 0;
+  for (; t < 30000; t += dt)
+    tracker.push(synthetic_pulse(t, 72), t);
+  int n_peaks = tracker.peaks.size();
+  for (; t < 40000; t += dt)
+    tracker.push(off_finger(0, &seed), t);
+  ASSERT(tracker.gated_since >= 0, "Tracker isn't gated on an off finger signal");
+  ASSERT(tracker.peaks.size() <= n_peaks+2, "Found %d peaks in an off finger signal", tracker.peaks.size()-n_peaks);
+  tracker.get_heartrate(&hr);
+  ASSERT(strcmp(hr.err, "Poor signal: clipped") == 0, "err = \"%s\"", hr.err);
+  for (; t < 70000; t += dt)
+    tracker.push(synthetic_pulse(t, 90), t);
+  tracker.get_heartrate(&hr);
+  ASSERT(tracker.gated_since == -1, "Tracker still gated on a good signal");
+  ASSERT(hr.err[0] == 0, "Heart rate error after the finger came back: %s", hr.err);
+  ASSERT(abs(hr.hr-90) < 1, "hr = %f and not 90", hr.hr);
+  return true;
+}
+
+bool bench_signal_quality() {
+  Serial.println("Benchmarking off finger push cost...");
+  const long dt = 1000/PULSE_SAMPLE_RATE;
+  const long duration = 120000;
+  char l[128];
+  struct { const char* name; float level; } traces[] = {
+    {"floating 512", 512},
+    {"pegged 0", 0},
+    {"pegged 1023", 1023},
+  };
+  for (auto& trace : traces) {
+    unsigned long us[2];
+    int n_peaks[2];
+    for (int gate = 0; gate < 2; gate++) {
+      PulseTrackerInternals tracker;
+      tracker.quality_gate = gate;
+      unsigned int seed = 7;
+      unsigned long start = micros();
+      for (long t = 0; t < duration; t += dt)
+        tracker.push(off_finger(trace.level, &seed), t);
+      us[gate] = micros()-start;
+      n_peaks[gate] = tracker.peaks.size();
+    }
+    sprintf(l, "  %-12s ungated: %.3fus/sample %d peaks, gated: %.3fus/sample %d peaks",
+      trace.name, (float)us[0]*dt/duration, n_peaks[0], (float)us[1]*dt/duration, n_peaks[1]);
+    Serial.println(l);
+  }
+  return true;
+}
+
+// time to the first hr, and to the hr staying within 5% of the truth
+void time_to_hr(bool noisy, float bpm, bool warm_up, long* first, long* stable) {
+  const long dt = 1000/PULSE_SAMPLE_RATE;
+  PulseTrackerInternals tracker;
+  tracker.warming_up = warm_up;
+  HeartRate hr;
+  (*first) = -1;
+  (*stable) = -1;
+  unsigned int seed = 1;
+  for (long t = 0; t < 60000; t += dt) {
+    tracker.push(noisy ? noisy_pulse(t, bpm, &seed) : synthetic_pulse(t, bpm), t);
+    tracker.get_heartrate(&hr);
+    if (hr.err[0] != 0)
+      continue;
+    if (*first < 0)
+      (*first) = t;
+    if (abs(hr.hr-bpm)/bpm > 0.05)
+      (*stable) = -1;
+    else if (*stable < 0)
+      (*stable) = t;
+  }
+}
+
+bool bench_time_to_hr() {
+  Serial.println("Benchmarking time to first hr (ms)...");
+  struct { const char* name; bool noisy; float bpm; } sessions[] = {
+    {"clean 60bpm", false, 60},
+    {"clean 120bpm", false, 120},
+    {"noisy 72bpm", true, 72},
+    {"noisy 100bpm", true, 100},
+  };
+  char l[128];
+  Serial.println("  session          first(prov) stable(prov) first(full) stable(full)");
+  for (auto& s : sessions) {
+    long first_p, stable_p, first_f, stable_f;
+    time_to_hr(s.noisy, s.bpm, true, &first_p, &stable_p);
+    time_to_hr(s.noisy, s.bpm, false, &first_f, &stable_f);
+    sprintf(l, "  %-16s %11ld %12ld %11ld %12ld", s.name, first_p, stable_p, first_f, stable_f);
+    Serial.println(l);
+    ASSERT(first_p >= 0 && first_p <= first_f, "Provisional mode didn't speed up the first hr for %s", s.name);
+    ASSERT(stable_p >= 0 && stable_p <= stable_f, "Provisional mode didn't speed up the stable hr for %s", s.name);
+  }
+  return true;
+}
+
+#ifdef PULSE_COST_MODEL
+// estimated ESP8266 cycles per push, by stage, from counting the ops of a host run
+void cost_per_push(bool noisy, bool robust, const CycleTable& table) {
+  const long dt = 1000/PULSE_SAMPLE_RATE;
+  PulseTrackerInternals tracker;
+  // everything the sketch hangs off of the tracker
+  HeartRateHistory history;
+  HeartRateVariability hrv;
+  tracker.history = &history;
+  tracker.hrv = &hrv;
+  tracker.robust_inspection = robust;
+  unsigned int seed = 1;
+  // skip the warm up, it's not the steady state cost
+  long t = 0;
+  for (; t < 30000; t += dt)
+    tracker.push(noisy ? noisy_pulse(t, 72, &seed) : synthetic_pulse(t, 72), t);
+  opcount_reset();
+  long pushes = 0;
+  float worst = 0;
+  for (; t < 150000; t += dt) {
+    OpCounts before = opcount_ops;
+    tracker.push(noisy ? noisy_pulse(t, 72, &seed) : synthetic_pulse(t, 72), t);
+    float cycles = table.cycles(opcount_ops-before);
+    worst = cycles > worst ? cycles : worst;
+    pushes++;
+  }
+  const char* names[] = OPCOUNT_STAGE_NAMES;
+  char l[128];
+  for (int i = 0; i < OPCOUNT_STAGES; i++) {
+    OpCounts& ops = opcount_stage_ops[i];
+    sprintf(l, "  %-9s %6.1f %6.1f %6.1f %6.1f %6.1f %6.2f %6.1f %6.1f %6.1f  %8.0f",
+      names[i], (float)ops.fadd/pushes, (float)ops.fmul/pushes, (float)ops.fdiv/pushes, (float)ops.fcmp/pushes,
+      (float)ops.fconv/pushes, (float)ops.fsqrt/pushes, (float)ops.imod/pushes, (float)ops.ladd/pushes,
+      (float)ops.lmul/pushes, table.cycles(ops)/pushes);
+    Serial.println(l);
+  }
+  // the ESP8266 runs at 80MHz, so there are 80e6/PULSE_SAMPLE_RATE cycles between samples
+  float total = table.cycles(opcount_ops)/pushes;
+  sprintf(l, "  total: %.0f cycles/push (worst %.0f), %.3f%% of the %d cycles between samples",
+    total, worst, 100*total/(80000000/PULSE_SAMPLE_RATE), 80000000/PULSE_SAMPLE_RATE);
+  Serial.println(l);
+}
+#endif
+
+bool bench_cost_model() {
+  Serial.println("Estimating ESP8266 cycles per push...");
+  #ifdef PULSE_COST_MODEL
+  CycleTable table;
+  Serial.println("  ops/push:   fadd   fmul   fdiv   fcmp  fconv  fsqrt   imod   ladd   lmul    cycles");
+  Serial.println("  clean 72bpm");
+  cost_per_push(false, false, table);
+  Serial.println("  noisy 72bpm");
+  cost_per_push(true, false, table);
+  Serial.println("  noisy 72bpm, robust inspection");
+  cost_per_push(true, true, table);
+  #else
+  Serial.println("  PULSE_COST_MODEL isn't defined, build with it on the host to count ops");
+  #endif
+  return true;
+}
+
 bool all_pulse_tests() {
   Serial.println("Running tests for \"pulse.h\\cpp\"...");
 
   ASSERT(test_ring_buffer(), "RingBuffer Failed");
   ASSERT(test_stream(), "Test Stream Failed");
   ASSERT(test_peak_buffer(), "PeakBuffer Failed");
+  ASSERT(test_peak_ranges(), "PeakBuffer Ranges Failed");
   ASSERT(test_peak_detection(), "Peak Detection Failed");
+  ASSERT(test_slope_window_lengths(), "Slope Window Lengths Failed");
   ASSERT(test_update_peak_stats(), "Peak Stats Update Failed");
   ASSERT(test_inspect_pulses(), "Inspecting Pulses Failed");
   ASSERT(test_resolve_questionable(), "Resolving Questionable Pulses Failed");
+  ASSERT(test_order_stat_window(), "OrderStatWindow Failed");
+  ASSERT(test_robust_inspection(), "Robust Inspection Failed");
+  ASSERT(test_lazy_order_window(), "Lazy Order Window Failed");
+  ASSERT(test_heartrate(), "Heart Rate Failed");
+  ASSERT(test_provisional_stats(), "Provisional Stats Failed");
+  ASSERT(test_provisional_noisy(), "Provisional Noisy Failed");
+  ASSERT(test_windowed_quantiles(), "WindowedQuantiles Failed");
+  ASSERT(test_hr_bounds(), "Heart Rate Bounds Failed");
+  ASSERT(test_signal_quality(), "Signal Quality Failed");
+  ASSERT(test_snapshot_restore(), "Snapshot/Restore Failed");
   
   Serial.println("All tests pass!");
   return true;
-}
\ No newline at end of file
+}
+
+bool bench_snapshot_restore() {
+  Serial.println("Benchmarking tracker snapshot/restore...");
+  const long dt = 1000/PULSE_SAMPLE_RATE;
+  const int iters = 100;
+  PulseTrackerInternals a;
+  for (long t = 0; t < 60000; t += dt)
+    a.push(synthetic_pulse(t, 72), t);
+  std::unique_ptr<char[]> buf(new char[PULSE_TEST_SNAPSHOT_BYTES]);
+  char* snap = buf.get();
+  int n = 0;
+  unsigned long start = micros();
+  for (int i = 0; i < iters; i++)
+    n = a.snapshot(snap, PULSE_TEST_SNAPSHOT_BYTES);
+  ASSERT(n > 0, "Snapshot didn't fit in %d bytes", PULSE_TEST_SNAPSHOT_BYTES);
+  unsigned long snap_us = micros()-start;
+  PulseTrackerInternals b;
+  start = micros();
+  for (int i = 0; i < iters; i++)
+    b.restore(snap, n, a.last_time, 0);
+  unsigned long restore_us = micros()-start;
+  char l[128];
+  sprintf(l, "  %d bytes, snapshot: %.2fus, restore: %.2fus",
+    n, (float)snap_us/iters, (float)restore_us/iters);
+  Serial.println(l);
+  return true;
+}
+
+bool all_pulse_benchmarks() {
+  Serial.println("Running benchmarks for \"pulse.h\\cpp\"...");
+
+  ASSERT(bench_peak_ranges(), "PeakBuffer Ranges Benchmark Failed");
+  ASSERT(bench_robust_inspection(), "Robust Inspection Benchmark Failed");
+  ASSERT(bench_time_to_hr(), "Time to HR Benchmark Failed");
+  ASSERT(bench_quantiles(), "Quantiles Benchmark Failed");
+  ASSERT(bench_signal_quality(), "Signal Quality Benchmark Failed");
+  ASSERT(bench_cost_model(), "Cost Model Benchmark Failed");
+  ASSERT(bench_snapshot_restore(), "Snapshot/Restore Benchmark Failed");
+
+  Serial.println("All benchmarks pass!");
+  return true;
+}
@@ -5,5 +5,7 @@
 #include "pulse.h"
 
 bool all_pulse_tests();
+// too slow to run on the ESP8266 at boot, so only run on a PC (see host/tests.cpp)
+bool all_pulse_benchmarks();
 
 #endif
\ No newline at end of file
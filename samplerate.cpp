@@ -0,0 +1,24 @@
+#include "samplerate.h"
+
+void SampleRateController::go_to(int rate) {
+  if (rate == current)
+    return;
+  current = rate;
+  changes++;
+}
+
+bool SampleRateController::update(const HeartRate& hr, long now) {
+  int before = current;
+  if (hr.err[0] != 0 || hr.provisional || now-hr.time > SAMPLE_RATE_STALE_MS) {
+    steady_since = -1;
+    go_to(SAMPLE_RATE_MAX);
+  } else if (steady_since < 0 || abs(hr.hr-steady_hr) > SAMPLE_RATE_STEADY_BPM) {
+    // settling somewhere new
+    steady_since = now;
+    steady_hr = hr.hr;
+    go_to(SAMPLE_RATE_MAX);
+  } else if (now-steady_since >= SAMPLE_RATE_STEADY_MS) {
+    go_to(SAMPLE_RATE_MIN);
+  }
+  return current != before;
+}
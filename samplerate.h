@@ -0,0 +1,34 @@
+#ifndef SAMPLERATE_H
+#define SAMPLERATE_H
+
+#include "pulse.h"
+
+#define SAMPLE_RATE_MAX PULSE_SAMPLE_RATE // samples per second whenever there's any doubt
+#define SAMPLE_RATE_MIN 20 // samples per second once the rhythm is steady
+#define SAMPLE_RATE_STEADY_MS 30000 // the heart rate has to be steady for this long before slowing down
+#define SAMPLE_RATE_STEADY_BPM 4 // steady = staying within this many bpm of where it settled
+#define SAMPLE_RATE_STALE_MS (PULSE_VALIDATION_WINDOW_MS+5000) // heart rates lag by up to a validation window, any older and the peaks have stopped coming
+
+// Picks the sample rate from how steady the heart rate is, so the timer interrupt, the tracker
+// and the logging can all do less work while nothing interesting is happening.
+// The tracker's slope window is time based, so it doesn't need to be told about the change.
+class SampleRateController {
+  private:
+    int current = SAMPLE_RATE_MAX;
+    long steady_since = -1;
+    float steady_hr = -1;
+    void go_to(int rate);
+  public:
+    // number of times the rate has changed
+    int changes = 0;
+    // Looks at the latest heart rate, and returns true if the sample rate should change.
+    // An error (no heart rate, poor signal), a provisional or stale heart rate, or one that's moved more
+    // than SAMPLE_RATE_STEADY_BPM from where it settled goes straight back to SAMPLE_RATE_MAX.
+    // Only after SAMPLE_RATE_STEADY_MS of steady heart rates does it drop to SAMPLE_RATE_MIN.
+    bool update(const HeartRate& hr, long now);
+    int rate() const { return current; }
+    long interval_us() const { return 1000000L/current; }
+    long interval_ms() const { return 1000L/current; }
+};
+
+#endif
@@ -0,0 +1,201 @@
+#include "samplerate_test.h"
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <math.h>
+
+#define ASSERT(t, msg, ...) if(!(t)){char l[128];sprintf(l, msg __VA_OPT__(,) __VA_ARGS__);Serial.println(l);return false;}
+
+HeartRate steady_hr(long t, float bpm) {
+  HeartRate hr;
+  hr.time = t;
+  hr.hr = bpm;
+  hr.hr_lb = bpm-2;
+  hr.hr_ub = bpm+2;
+  hr.provisional = false;
+  hr.err[0] = 0;
+  return hr;
+}
+
+bool test_rate_controller() {
+  Serial.println("Testing SampleRateController...");
+  SampleRateController rc;
+  ASSERT(rc.rate() == SAMPLE_RATE_MAX, "Didn't start at the max rate");
+  long t = 0;
+  for (; t < SAMPLE_RATE_STEADY_MS; t += 1000) {
+    ASSERT(!rc.update(steady_hr(t, 70+(t/1000)%3), t), "Changed rate before being steady long enough at %ldms", t);
+  }
+  ASSERT(rc.update(steady_hr(t, 71), t) && rc.rate() == SAMPLE_RATE_MIN, "Didn't slow down when steady");
+  ASSERT(rc.interval_ms() == 1000/SAMPLE_RATE_MIN, "interval = %ldms", rc.interval_ms());
+  t += 1000;
+  // moving away from the steady rate speeds straight back up
+  ASSERT(rc.update(steady_hr(t, 70+SAMPLE_RATE_STEADY_BPM+1), t) && rc.rate() == SAMPLE_RATE_MAX, "Didn't speed up for a new rate");
+  ASSERT(!rc.update(steady_hr(t+1000, 75), t+1000), "Slowed down right after a change");
+
+  // anything off about the heart rate speeds up too
+  const char* reasons[] = {"error", "provisional", "stale"};
+  for (int i = 0; i < 3; i++) {
+    SampleRateController r;
+    long s = 0;
+    for (; s <= SAMPLE_RATE_STEADY_MS; s += 1000)
+      r.update(steady_hr(s, 70), s);
+    ASSERT(r.rate() == SAMPLE_RATE_MIN, "Didn't slow down");
+    HeartRate hr = steady_hr(s, 70);
+    if (i == 0)
+      strcpy(hr.err, "Poor signal: flat");
+    if (i == 1)
+      hr.provisional = true;
+    if (i == 2)
+      hr.time = s-SAMPLE_RATE_STALE_MS-1;
+    ASSERT(r.update(hr, s) && r.rate() == SAMPLE_RATE_MAX, "Didn't speed up for a %s heart rate", reasons[i]);
+  }
+  return true;
+}
+
+// A session with steady stretches, a climb (e.g. climbing stairs), the finger slipping off, and a recovery.
+struct Session {
+  long climb_at, climb_ms; // 65bpm until climb_at, then up to 95bpm over climb_ms
+  long off_at, off_ms; // the finger slips off at off_at, and the rate is down to 70bpm when it's back
+  long duration;
+};
+// long enough that the savings aren't dominated by the warm up
+const Session long_session = {180000, 60000, 420000, 10000, 600000};
+// the same story, with just enough time to settle in between, to run at boot
+const Session short_session = {75000, 20000, 155000, 5000, 175000};
+
+float session_bpm(const Session& s, long t) {
+  if (t < s.climb_at)
+    return 65+sin(t*2*M_PI/5000);
+  if (t < s.climb_at+s.climb_ms)
+    return 65+30.0*(t-s.climb_at)/s.climb_ms;
+  if (t < s.off_at)
+    return 95+sin(t*2*M_PI/5000);
+  return 70+sin(t*2*M_PI/5000);
+}
+bool session_off_finger(const Session& s, long t) {
+  return t >= s.off_at && t < s.off_at+s.off_ms;
+}
+
+struct SessionResult {
+  long samples = 0;
+  unsigned long push_us = 0; // host time spent in push
+  long scored = 0, covered = 0;
+  float mean_err = 0;
+  long ms_at_min = 0; // time spent at SAMPLE_RATE_MIN
+  std::vector<int> rate_at; // the rate every second
+};
+
+// Samples the session the way the timer would, at either a fixed rate or the one the controller picks,
+// with the heart rate checked (and handed to the controller) every second.
+void run_session(const Session& session, bool adaptive, SessionResult* out) {
+  PulseTrackerInternals tracker;
+  SampleRateController rc;
+  unsigned int seed = 31;
+  double phase = 0;
+  long next_sample = 0;
+  double err_sum = 0;
+  HeartRate hr;
+  out->rate_at.resize(session.duration/1000);
+  for (long t = 0; t < session.duration; t++) {
+    phase += session_bpm(session, t)/60000.0;
+    if (t%1000 == 0) {
+      out->rate_at[t/1000] = rc.rate();
+      tracker.get_heartrate(&hr);
+      if (t >= 15000) {
+        out->scored++;
+        if (hr.err[0] == 0) {
+          out->covered++;
+          err_sum += abs(hr.hr-session_bpm(session, hr.time));
+        }
+      }
+      if (adaptive)
+        rc.update(hr, t);
+    }
+    if (rc.rate() == SAMPLE_RATE_MIN)
+      out->ms_at_min++;
+    if (t < next_sample)
+      continue;
+    next_sample = t+rc.interval_ms();
+    seed = seed*1103515245+12345;
+    int noise = (int)((seed>>16)%31)-15;
+    int signal;
+    if (session_off_finger(session, t)) {
+      signal = 512+noise/3;
+    } else {
+      float p = phase-floor(phase);
+      float v = p < 0.15 ? p/0.15 : exp(-(p-0.15)*4);
+      float notch = p > 0.45 && p < 0.65 ? 50*sin((p-0.45)*M_PI/0.2) : 0;
+      signal = 300+(int)(400*v)+(int)notch+noise;
+    }
+    unsigned long start = micros();
+    tracker.push(signal, t);
+    out->push_us += micros()-start;
+    out->samples++;
+  }
+  out->mean_err = out->covered > 0 ? err_sum/out->covered : -1;
+}
+
+bool test_adaptive_session() {
+  Serial.println("Testing an adaptively sampled session...");
+  SessionResult fixed, adaptive;
+  run_session(short_session, false, &fixed);
+  run_session(short_session, true, &adaptive);
+  ASSERT(adaptive.samples < fixed.samples, "Didn't save any samples");
+  ASSERT(adaptive.covered >= fixed.covered*95/100, "Covered %ld seconds, %ld at a fixed rate", adaptive.covered, fixed.covered);
+  ASSERT(adaptive.mean_err < fixed.mean_err+1, "Off by %f bpm, %f at a fixed rate", adaptive.mean_err, fixed.mean_err);
+  // slows down in the steady stretches, speeds back up for the climb and the finger slipping off
+  ASSERT(adaptive.rate_at[70] == SAMPLE_RATE_MIN, "Not slowed down before the climb");
+  ASSERT(adaptive.rate_at[95] == SAMPLE_RATE_MAX, "Not sped up for the climb");
+  ASSERT(adaptive.rate_at[150] == SAMPLE_RATE_MIN, "Not slowed down after the climb");
+  ASSERT(adaptive.rate_at[160] == SAMPLE_RATE_MAX, "Not sped up when the finger slipped off");
+  return true;
+}
+
+bool bench_adaptive_session() {
+  Serial.println("Benchmarking adaptive vs fixed sampling over a 10 minute session...");
+  SessionResult fixed, adaptive;
+  run_session(long_session, false, &fixed);
+  run_session(long_session, true, &adaptive);
+  // with long steady stretches most of the session is at the min rate
+  ASSERT(adaptive.samples < fixed.samples*3/4, "Only saved %ld of %ld samples", fixed.samples-adaptive.samples, fixed.samples);
+  ASSERT(adaptive.covered >= fixed.covered*95/100, "Covered %ld seconds, %ld at a fixed rate", adaptive.covered, fixed.covered);
+  ASSERT(adaptive.mean_err < fixed.mean_err+1, "Off by %f bpm, %f at a fixed rate", adaptive.mean_err, fixed.mean_err);
+  ASSERT(adaptive.rate_at[170] == SAMPLE_RATE_MIN, "Not slowed down before the climb");
+  ASSERT(adaptive.rate_at[205] == SAMPLE_RATE_MAX, "Not sped up for the climb");
+  ASSERT(adaptive.rate_at[410] == SAMPLE_RATE_MIN, "Not slowed down after the climb");
+  ASSERT(adaptive.rate_at[425] == SAMPLE_RATE_MAX, "Not sped up when the finger slipped off");
+  Serial.println("            samples  push(ms)  at min rate  covered  mean err");
+  const SessionResult* results[] = {&fixed, &adaptive};
+  const char* names[] = {"fixed", "adaptive"};
+  char l[128];
+  for (int i = 0; i < 2; i++) {
+    const SessionResult& r = *results[i];
+    sprintf(l, "  %-8s %9ld %9.1f %11.1f%% %7.1f%% %9.2f",
+      names[i], r.samples, r.push_us/1000.0, 100.0*r.ms_at_min/long_session.duration, 100.0*r.covered/r.scored, r.mean_err);
+    Serial.println(l);
+  }
+  // every sample is an interrupt, an analogRead, a push and a log line on the device
+  sprintf(l, "  %.1f%% fewer samples (interrupts, pushes and log lines), %.1f%% less push time",
+    100.0-100.0*adaptive.samples/fixed.samples, 100.0-100.0*adaptive.push_us/fixed.push_us);
+  Serial.println(l);
+  return true;
+}
+
+bool all_samplerate_tests() {
+  Serial.println("Running tests for \"samplerate.h\\cpp\"...");
+
+  ASSERT(test_rate_controller(), "Sample Rate Controller Failed");
+  ASSERT(test_adaptive_session(), "Adaptive Session Failed");
+
+  Serial.println("All tests pass!");
+  return true;
+}
+
+bool all_samplerate_benchmarks() {
+  Serial.println("Running benchmarks for \"samplerate.h\\cpp\"...");
+
+  ASSERT(bench_adaptive_session(), "Adaptive Session Benchmark Failed");
+
+  Serial.println("All benchmarks pass!");
+  return true;
+}
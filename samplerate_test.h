@@ -0,0 +1,11 @@
+#ifndef SAMPLERATE_TEST_H
+#define SAMPLERATE_TEST_H
+
+#include <Arduino.h>
+#include "samplerate.h"
+
+bool all_samplerate_tests();
+// too slow to run on the ESP8266 at boot, so only run on a PC (see host/tests.cpp)
+bool all_samplerate_benchmarks();
+
+#endif
@@ -0,0 +1,51 @@
+#include "samplering.h"
+
+int SampleRing::round_up(int capacity) {
+  int c = 1;
+  while (c < capacity)
+    c *= 2;
+  return c;
+}
+
+void SampleCursor::catch_up(unsigned long w) {
+  unsigned long l = w-next;
+  if (l > max_lag)
+    max_lag = l;
+  // the slot for w is the one the writer will use next, which is the same as the
+  // slot for w-cap, so only w-cap+1 onwards are safe to read
+  if (l >= (unsigned long)ring.cap) {
+    overruns += l-ring.cap+1;
+    next = w-ring.cap+1;
+  }
+}
+
+const Sample* SampleCursor::peek() {
+  unsigned long w = ring.total_written();
+  if (next == w)
+    return nullptr;
+  catch_up(w);
+  return &ring.buffer[next&(ring.cap-1)];
+}
+
+bool SampleCursor::release() {
+  // the reads of the sample have to finish before the count is checked
+  std::atomic_thread_fence(std::memory_order_acquire);
+  unsigned long w = ring.written.load(std::memory_order_relaxed);
+  // lapped while the sample was in use, it may have been (partially) overwritten
+  if (w-next >= (unsigned long)ring.cap) {
+    catch_up(w);
+    return false;
+  }
+  next++;
+  return true;
+}
+
+bool SampleCursor::read(Sample* out) {
+  const Sample* s;
+  while ((s = peek()) != nullptr) {
+    (*out) = *s;
+    if (release())
+      return true;
+  }
+  return false;
+}
@@ -0,0 +1,72 @@
+#ifndef SAMPLERING_H
+#define SAMPLERING_H
+
+#include <atomic>
+#include <memory>
+
+struct Sample {
+  long t; // time of the sample, millisecs
+  int signal; // raw adc reading
+};
+
+class SampleCursor;
+
+// A ring of raw samples, written once by a single producer (the timer interrupt)
+// and read by any number of SampleCursors, each at its own pace.
+// Nothing is locked, readers check the write count after reading to see if they were lapped.
+// The capacity is rounded up to a power of two, so that the slots stay in order when the write
+// count wraps around.
+class SampleRing {
+  private:
+    std::unique_ptr<Sample[]> buffer;
+    const int cap;
+    // number of samples ever written, only the producer changes it.
+    // Stored with release and loaded with acquire, so a reader that sees a count also sees the samples before it.
+    std::atomic<unsigned long> written;
+    static int round_up(int capacity);
+  public:
+    // start is where the write count begins, only worth changing to test the wrap around
+    SampleRing(int capacity, unsigned long start=0)
+      : buffer(new Sample[round_up(capacity)]), cap(round_up(capacity)), written(start) {}
+    // fast, safe to call from an interrupt, but there can only be one writer
+    void write(long t, int signal) {
+      unsigned long w = written.load(std::memory_order_relaxed);
+      Sample& s = buffer[w&(cap-1)];
+      s.t = t;
+      s.signal = signal;
+      // publish only after the sample is in place
+      written.store(w+1, std::memory_order_release);
+    }
+    unsigned long total_written() const { return written.load(std::memory_order_acquire); }
+    int capacity() const { return cap; }
+  friend SampleCursor;
+};
+
+// An independent read position in a SampleRing.
+// A cursor that falls more than capacity()-1 samples behind skips ahead, and counts the skipped samples as overruns.
+class SampleCursor {
+  private:
+    const SampleRing& ring;
+    unsigned long next;
+    // skip ahead if the writer lapped us
+    void catch_up(unsigned long w);
+  public:
+    // starts at the ring's current write position, so only sees new samples
+    SampleCursor(const SampleRing& ring) : ring(ring), next(ring.total_written()) {}
+    // number of samples this cursor missed because it fell too far behind
+    unsigned long overruns = 0;
+    // the furthest this cursor has been behind the writer
+    unsigned long max_lag = 0;
+    // number of samples waiting to be read
+    unsigned long lag() const { return ring.total_written()-next; }
+    // Zero copy read: a pointer to the next sample in the ring, or nullptr if there isn't one.
+    // The sample can be overwritten while it's being used, so always check release()'s return.
+    const Sample* peek();
+    // Done with the peeked sample. Returns false if it was overwritten while being
+    // used, in which case whatever was done with it should be discarded.
+    bool release();
+    // copies out the next sample, returns false if there isn't one
+    bool read(Sample* out);
+};
+
+#endif
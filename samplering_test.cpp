@@ -0,0 +1,132 @@
+#include "samplering_test.h"
+#include <climits>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#define ASSERT(t, msg, ...) if(!(t)){char l[128];sprintf(l, msg __VA_OPT__(,) __VA_ARGS__);Serial.println(l);return false;}
+
+bool test_cursors() {
+  Serial.println("Testing SampleRing cursors...");
+  SampleRing ring(8);
+  ring.write(-25, -1);
+  SampleCursor fast(ring);
+  SampleCursor slow(ring);
+  Sample s;
+  ASSERT(!fast.read(&s), "Cursor saw a sample from before it was created");
+  for (int i = 0; i < 5; i++)
+    ring.write(i*25, i);
+  for (int i = 0; i < 5; i++) {
+    ASSERT(fast.read(&s), "Fast cursor ran out at %d", i);
+    ASSERT(s.signal == i && s.t == i*25, "Fast cursor read %d and not %d", s.signal, i);
+  }
+  ASSERT(!fast.read(&s), "Fast cursor read past the writer");
+  ASSERT(slow.lag() == 5, "Slow cursor lag = %lu and not 5", slow.lag());
+  ASSERT(slow.read(&s) && s.signal == 0, "Slow cursor didn't start at the beginning");
+  ASSERT(fast.overruns == 0 && slow.overruns == 0, "Unexpected overruns");
+  return true;
+}
+
+bool test_overruns() {
+  Serial.println("Testing SampleRing overruns...");
+  SampleRing ring(8);
+  SampleCursor cursor(ring);
+  for (int i = 0; i < 20; i++)
+    ring.write(i*25, i);
+  Sample s;
+  ASSERT(cursor.read(&s), "Nothing to read");
+  ASSERT(s.signal == 13, "Read %d and not 13 after being lapped", s.signal);
+  ASSERT(cursor.overruns == 13, "overruns = %lu and not 13", cursor.overruns);
+  ASSERT(cursor.max_lag == 20, "max_lag = %lu and not 20", cursor.max_lag);
+  int n = 1;
+  while (cursor.read(&s))
+    n++;
+  ASSERT(n == 7 && s.signal == 19, "Read %d samples ending in %d", n, s.signal);
+
+  // lapped while holding on to a peeked sample
+  const Sample* p = cursor.peek();
+  ASSERT(p == nullptr, "Peeked past the writer");
+  ring.write(500, 20);
+  p = cursor.peek();
+  ASSERT(p != nullptr && p->signal == 20, "Couldn't peek the new sample");
+  for (int i = 0; i < ring.capacity(); i++)
+    ring.write(525+i*25, 21+i);
+  ASSERT(!cursor.release(), "Release didn't notice the sample was overwritten");
+  ASSERT(cursor.read(&s) && s.signal == 21+1, "Read %d after the overwrite and not 22", s.signal);
+  return true;
+}
+
+bool test_wrap_around() {
+  Serial.println("Testing SampleRing capacity and wrap around...");
+  ASSERT(SampleRing(6).capacity() == 8, "Capacity of 6 wasn't rounded up to 8");
+  ASSERT(SampleRing(8).capacity() == 8, "Capacity of 8 changed to %d", SampleRing(8).capacity());
+  // the write count wraps around to 0 halfway through
+  SampleRing ring(6, ULONG_MAX-4);
+  SampleCursor cursor(ring);
+  Sample s;
+  for (int i = 0; i < 10; i++) {
+    ring.write(i*25, i);
+    ASSERT(cursor.read(&s) && s.signal == i, "Read %d and not %d across the wrap", s.signal, i);
+  }
+  // and a lapped cursor still lands on the oldest unwritten slot
+  SampleRing lapped(8, ULONG_MAX-4);
+  SampleCursor behind(lapped);
+  for (int i = 0; i < 20; i++)
+    lapped.write(i*25, i);
+  ASSERT(behind.read(&s) && s.signal == 13, "Read %d and not 13 after being lapped across the wrap", s.signal);
+  ASSERT(behind.overruns == 13, "overruns = %lu and not 13", behind.overruns);
+  return true;
+}
+
+bool bench_sample_ring() {
+  Serial.println("Benchmarking SampleRing...");
+  const int n_samples = 100000;
+  const int batch = 16;
+  char l[128];
+  for (int n_cursors = 1; n_cursors <= 8; n_cursors *= 2) {
+    SampleRing ring(64);
+    std::vector<std::unique_ptr<SampleCursor>> cursors;
+    for (int i = 0; i < n_cursors; i++)
+      cursors.push_back(std::make_unique<SampleCursor>(ring));
+    volatile long checksum = 0;
+    unsigned long start = micros();
+    for (int i = 0; i < n_samples; i += batch) {
+      for (int j = i; j < i+batch; j++)
+        ring.write(j*25, j&1023);
+      Sample s;
+      for (auto& c : cursors) {
+        while (c->read(&s))
+          checksum = checksum+s.signal;
+      }
+    }
+    unsigned long elapsed = micros()-start;
+    unsigned long overruns = 0;
+    for (auto& c : cursors)
+      overruns += c->overruns;
+    ASSERT(overruns == 0, "%lu overruns with %d cursors", overruns, n_cursors);
+    sprintf(l, "  %d cursors: %.0f samples/sec written, %.0f reads/sec",
+      n_cursors, n_samples*1e6/elapsed, (float)n_samples*n_cursors*1e6/elapsed);
+    Serial.println(l);
+  }
+  return true;
+}
+
+bool all_samplering_tests() {
+  Serial.println("Running tests for \"samplering.h\\cpp\"...");
+
+  ASSERT(test_cursors(), "Cursors Failed");
+  ASSERT(test_overruns(), "Overruns Failed");
+  ASSERT(test_wrap_around(), "Wrap Around Failed");
+
+  Serial.println("All tests pass!");
+  return true;
+}
+
+bool all_samplering_benchmarks() {
+  Serial.println("Running benchmarks for \"samplering.h\\cpp\"...");
+
+  ASSERT(bench_sample_ring(), "SampleRing Benchmark Failed");
+
+  Serial.println("All benchmarks pass!");
+  return true;
+}
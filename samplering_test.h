@@ -0,0 +1,11 @@
+#ifndef SAMPLERING_TEST_H
+#define SAMPLERING_TEST_H
+
+#include <Arduino.h>
+#include "samplering.h"
+
+bool all_samplering_tests();
+// too slow to run on the ESP8266 at boot, so only run on a PC (see host/tests.cpp)
+bool all_samplering_benchmarks();
+
+#endif
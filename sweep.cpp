@@ -0,0 +1,118 @@
+#include "sweep.h"
+#include <functional>
+#include <cstdio>
+#ifdef PULSE_SWEEP_THREADS
+#include <atomic>
+#include <thread>
+#endif
+
+// calls f(0) to f(count-1), spread across threads if there's more than one
+static void for_each(int count, int threads, const std::function<void(int)>& f) {
+  #ifdef PULSE_SWEEP_THREADS
+  if (threads > 1) {
+    std::atomic<int> next(0);
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; i++) {
+      pool.emplace_back([&]{
+        for (int j = next++; j < count; j = next++)
+          f(j);
+      });
+    }
+    for (std::thread& t : pool)
+      t.join();
+    return;
+  }
+  #else
+  (void)threads;
+  #endif
+  for (int j = 0; j < count; j++)
+    f(j);
+}
+
+void PulseSweep::precompute(const PulseParams& params, std::vector<SlopeSample>* out) const {
+  // the signal half of a tracker doesn't depend on anything but the slope window,
+  // so one tracker can stand in for all of the configs that share it
+  PulseTrackerInternals lead(params);
+  out->resize(n);
+  for (int i = 0; i < n; i++) {
+    SlopeSample& ss = (*out)[i];
+    if (lead.push_signal(samples[i].signal, samples[i].t))
+      lead.slope_and_max(&ss.slope, &ss.max_i, &ss.max_amp);
+    else
+      ss.max_i = -1;
+  }
+}
+
+void PulseSweep::run_config(const PulseParams& params, const std::vector<SlopeSample>* slopes, SweepResult* out) const {
+  PulseTrackerInternals tracker(params);
+  SweepResult r;
+  r.params = params;
+  double err_sum = 0;
+  long next_score = n > 0 ? samples[0].t+SWEEP_WARMUP_MS : 0;
+  HeartRate hr;
+  unsigned long start = micros();
+  for (int i = 0; i < n; i++) {
+    const Sample& s = samples[i];
+    if (slopes == nullptr) {
+      tracker.push(s.signal, s.t);
+    } else if (tracker.push_signal(s.signal, s.t)) {
+      const SlopeSample& ss = (*slopes)[i];
+      tracker.push_slope(ss.slope, ss.max_i, ss.max_amp);
+    }
+    if (s.t < next_score)
+      continue;
+    next_score += SWEEP_SCORE_INTERVAL_MS;
+    r.scored++;
+    tracker.get_heartrate(&hr);
+    if (hr.err[0] != 0)
+      continue;
+    r.covered++;
+    float err = abs(hr.hr-true_bpm[i]);
+    err_sum += err;
+    r.max_err = err > r.max_err ? err : r.max_err;
+  }
+  r.us_per_sample = n > 0 ? (float)(micros()-start)/n : 0;
+  r.mean_err = r.covered > 0 ? err_sum/r.covered : -1;
+  (*out) = r;
+}
+
+int PulseSweep::run(const PulseParams* configs, int n_configs, SweepResult* results, int threads) const {
+  // group the configs by slope window, which has to be by its length in ms since the samples
+  // are timestamped, and windows that hold the same number of samples can still differ
+  std::vector<int> windows;
+  std::vector<int> group(n_configs);
+  for (int i = 0; i < n_configs; i++) {
+    int w = configs[i].slope_window_ms;
+    int g = 0;
+    while (g < (int)windows.size() && windows[g] != w)
+      g++;
+    if (g == (int)windows.size())
+      windows.push_back(w);
+    group[i] = g;
+  }
+  std::vector<std::vector<SlopeSample>> slopes(windows.size());
+  for_each(windows.size(), threads, [&](int g) {
+    for (int i = 0; i < n_configs; i++) {
+      if (group[i] == g) {
+        precompute(configs[i], &slopes[g]);
+        break;
+      }
+    }
+  });
+  for_each(n_configs, threads, [&](int i) {
+    run_config(configs[i], &slopes[group[i]], &results[i]);
+  });
+  return windows.size();
+}
+
+void PulseSweep::print(const SweepResult* results, int n_results) {
+  Serial.println("  slope valid      z  ratio | covered  mean err  max err | us/sample");
+  char l[128];
+  for (int i = 0; i < n_results; i++) {
+    const SweepResult& r = results[i];
+    sprintf(l, "  %5d %5ld %6.2f %6.2f | %6.1f%% %9.2f %8.2f | %9.3f",
+      r.params.slope_window_ms, r.params.validation_window_ms, r.params.false_pulse_z, r.params.false_pulse_ratio,
+      r.scored > 0 ? 100.0*r.covered/r.scored : 0.0, r.mean_err, r.max_err, r.us_per_sample);
+    Serial.println(l);
+  }
+}
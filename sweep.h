@@ -0,0 +1,50 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <vector>
+#include "pulse.h"
+#include "samplering.h"
+
+#define SWEEP_SCORE_INTERVAL_MS 1000 // how often each tracker's heart rate is scored against the truth
+#define SWEEP_WARMUP_MS 15000 // heart rates before this far into the recording aren't scored
+
+// How well one set of params did over a recording
+struct SweepResult {
+  PulseParams params;
+  long scored = 0; // number of times the heart rate was checked
+  long covered = 0; // number of those that had a heart rate
+  float mean_err = -1; // mean absolute error (bpm) of the covered heart rates, -1 if none
+  float max_err = -1;
+  float us_per_sample = 0; // time spent on this config, not counting the shared slopes
+};
+
+// Runs many sets of tracker params over the same recording (for tuning them on a PC).
+// The recording is only parsed once, and the slope of the signal window, which is most of the cost
+// of a push, is only calculated once for every distinct slope window. The configs are then
+// independent, so with PULSE_SWEEP_THREADS defined they're spread across threads.
+class PulseSweep {
+  private:
+    const Sample* samples;
+    const int n;
+    const float* true_bpm;
+    struct SlopeSample {
+      pfloat slope;
+      int max_i, max_amp;
+    };
+    // the slopes of every sample that fills a slope window, for one slope window
+    void precompute(const PulseParams& params, std::vector<SlopeSample>* out) const;
+    // runs a tracker over the recording, using slopes if given, and scores it
+    void run_config(const PulseParams& params, const std::vector<SlopeSample>* slopes, SweepResult* out) const;
+  public:
+    // true_bpm is the real heart rate at each sample
+    PulseSweep(const Sample* samples, int n, const float* true_bpm) : samples(samples), n(n), true_bpm(true_bpm) {}
+    // Runs every config, results[i] is for configs[i].
+    // Returns the number of slope windows, i.e. the number of times the slopes were calculated.
+    int run(const PulseParams* configs, int n_configs, SweepResult* results, int threads=1) const;
+    // the same as a config in run, but with every tracker calculating its own slopes
+    void run_unshared(const PulseParams& params, SweepResult* out) const { run_config(params, nullptr, out); }
+    // prints a row per result
+    static void print(const SweepResult* results, int n_results);
+};
+
+#endif
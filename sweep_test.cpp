@@ -0,0 +1,179 @@
+#include "sweep_test.h"
+#include "logparser.h"
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#ifdef PULSE_SWEEP_THREADS
+#include <thread>
+#endif
+
+#define SWEEP_TEST_WEAK_BEATS 3 // percent of beats too weak to find a peak in
+#define SWEEP_TEST_FALSE_BEATS 6 // percent of beats with a dicrotic bump big enough to look like a peak
+
+#define ASSERT(t, msg, ...) if(!(t)){char l[128];sprintf(l, msg __VA_OPT__(,) __VA_ARGS__);Serial.println(l);return false;}
+
+// A recording as the device would log it, of a pulse with a dicrotic bump and noise whose rate
+// slowly wanders between 60 and 100bpm, parsed back the same way a real log would be.
+// A few beats have a bump big enough to pass for a peak, and a few are too weak to be seen,
+// so there are false and missed pulses for the inspection params to sort out.
+// true_bpm gets the rate at each sample.
+void sweep_recording(long duration_ms, std::vector<Sample>* samples, std::vector<float>* true_bpm) {
+  PulseTracker tracker;
+  PulseLogParser parser(tracker);
+  parser.recording = samples;
+  unsigned int seed = 23;
+  float phase = 0;
+  char line[48];
+  for (long t = 0; t < duration_ms; t += 1000/PULSE_SAMPLE_RATE) {
+    float bpm = 80+20*sin(t*2*M_PI/300000);
+    phase += bpm/(60.0*PULSE_SAMPLE_RATE);
+    float p = phase-floor(phase);
+    float v = p < 0.15 ? p/0.15 : exp(-(p-0.15)*4);
+    // the same few percent of beats every time, whatever the duration
+    unsigned int beat = ((unsigned int)phase*2654435761u)>>16;
+    bool weak = beat%100 < SWEEP_TEST_WEAK_BEATS;
+    bool bump = !weak && beat%100 >= 100-SWEEP_TEST_FALSE_BEATS;
+    float notch = p > 0.45 && p < 0.65 ? (bump ? 200 : 40)*sin((p-0.45)*M_PI/0.2) : 0;
+    seed = seed*1103515245+12345;
+    int signal = 300+(int)((weak ? 40 : 400)*v)+(int)notch+(int)((seed>>16)%31)-15;
+    snprintf(line, sizeof(line), "p,%ld,%d,0\n", t, signal);
+    parser.feed(line, strlen(line));
+    true_bpm->push_back(bpm);
+  }
+}
+
+bool test_sweep_shared_slopes() {
+  Serial.println("Testing that shared slopes don't change the results...");
+  std::vector<Sample> samples;
+  std::vector<float> truth;
+  sweep_recording(60000, &samples, &truth);
+  ASSERT(samples.size() == truth.size(), "Parsed %d of %d samples", (int)samples.size(), (int)truth.size());
+  PulseSweep sweep(samples.data(), samples.size(), truth.data());
+  PulseParams configs[6];
+  // 240 and 249 hold the same number of samples, but aren't the same window
+  const int slopes[] = {240, 225, 249};
+  for (int i = 0; i < 6; i++) {
+    configs[i].slope_window_ms = slopes[i%3];
+    configs[i].false_pulse_z = i < 3 ? -1 : -0.5;
+  }
+  SweepResult results[6];
+  int windows = sweep.run(configs, 6, results, 2);
+  ASSERT(windows == 3, "Calculated the slopes for %d windows, not 3", windows);
+  for (int i = 0; i < 6; i++) {
+    SweepResult alone;
+    sweep.run_unshared(configs[i], &alone);
+    ASSERT(alone.scored == results[i].scored && alone.covered == results[i].covered
+      && alone.mean_err == results[i].mean_err && alone.max_err == results[i].max_err,
+      "Config %d: %ld/%ld %f bpm shared, %ld/%ld %f bpm alone", i,
+      results[i].covered, results[i].scored, results[i].mean_err, alone.covered, alone.scored, alone.mean_err);
+  }
+  // the default params should track this recording
+  ASSERT(results[1].covered > results[1].scored*9/10, "Default params only covered %ld of %ld", results[1].covered, results[1].scored);
+  ASSERT(results[1].mean_err < 3, "Default params are off by %f bpm", results[1].mean_err);
+  return true;
+}
+
+// the false pulse z and ratio only matter if inspection has false pulses to find
+bool test_sweep_inspection_params() {
+  Serial.println("Testing that the inspection params change the sweep results...");
+  std::vector<Sample> samples;
+  std::vector<float> truth;
+  sweep_recording(300000, &samples, &truth);
+  PulseSweep sweep(samples.data(), samples.size(), truth.data());
+  // z of -0.5 and -1.5 by ratio of 0.5 and 0.9
+  PulseParams configs[4];
+  for (int i = 0; i < 4; i++) {
+    configs[i].false_pulse_z = i/2 ? -1.5 : -0.5;
+    configs[i].false_pulse_ratio = i%2 ? 0.9 : 0.5;
+  }
+  SweepResult results[4];
+  sweep.run(configs, 4, results, 2);
+  ASSERT(results[1].mean_err != results[3].mean_err, "Changing the z didn't change the error (%f bpm)", results[1].mean_err);
+  ASSERT(results[0].mean_err != results[1].mean_err, "Changing the ratio didn't change the error (%f bpm)", results[0].mean_err);
+  // catching more of the false pulses should pay off
+  ASSERT(results[1].mean_err < results[0].mean_err, "A ratio of 0.9 (%f bpm) did no better than 0.5 (%f bpm)",
+    results[1].mean_err, results[0].mean_err);
+  return true;
+}
+
+bool bench_sweep() {
+  Serial.println("Benchmarking a parameter sweep...");
+  // a proper grid on a PC, a taste of one on the device
+  #ifdef PULSE_SWEEP_THREADS
+  const long duration = 300000;
+  const int slopes[] = {125, 175, 225, 275, 325};
+  const long windows[] = {4000, 6000, 8000, 10000, 12000, 14000};
+  const float zs[] = {-0.5, -0.75, -1, -1.25, -1.5};
+  const float ratios[] = {0.5, 0.6, 0.7, 0.8};
+  const int threads = std::thread::hardware_concurrency();
+  #else
+  const long duration = 60000;
+  const int slopes[] = {175, 225};
+  const long windows[] = {6000, 10000};
+  const float zs[] = {-0.5, -1};
+  const float ratios[] = {0.6, 0.7};
+  const int threads = 1;
+  #endif
+  std::vector<Sample> samples;
+  std::vector<float> truth;
+  sweep_recording(duration, &samples, &truth);
+  std::vector<PulseParams> configs;
+  for (int s : slopes)
+    for (long w : windows)
+      for (float z : zs)
+        for (float r : ratios) {
+          PulseParams p;
+          p.slope_window_ms = s;
+          p.validation_window_ms = w;
+          p.false_pulse_z = z;
+          p.false_pulse_ratio = r;
+          configs.push_back(p);
+        }
+  std::vector<SweepResult> results(configs.size());
+  PulseSweep sweep(samples.data(), samples.size(), truth.data());
+  unsigned long start = micros();
+  int n_slopes = sweep.run(configs.data(), configs.size(), results.data(), threads);
+  unsigned long elapsed = micros()-start;
+
+  // against every config calculating its own slopes, one thread, estimated from a few
+  start = micros();
+  const int n_unshared = 4;
+  for (int i = 0; i < n_unshared; i++) {
+    SweepResult r;
+    sweep.run_unshared(configs[i*configs.size()/n_unshared], &r);
+  }
+  float unshared_per_config = (float)(micros()-start)/n_unshared;
+
+  std::sort(results.begin(), results.end(), [](const SweepResult& a, const SweepResult& b) {
+    // most coverage first, then least error
+    if (a.covered != b.covered)
+      return a.covered > b.covered;
+    return a.mean_err < b.mean_err;
+  });
+  PulseSweep::print(results.data(), results.size() < 10 ? results.size() : 10);
+  char l[128];
+  sprintf(l, "  %d configs (%d slope windows) over %lds of samples on %d threads: %.1fms, %.1fms estimated unshared on one",
+    (int)configs.size(), n_slopes, duration/1000, threads, elapsed/1e3, unshared_per_config*configs.size()/1e3);
+  Serial.println(l);
+  return true;
+}
+
+bool all_sweep_tests() {
+  Serial.println("Running tests for \"sweep.h\\cpp\"...");
+
+  ASSERT(test_sweep_shared_slopes(), "Sweep Shared Slopes Failed");
+  ASSERT(test_sweep_inspection_params(), "Sweep Inspection Params Failed");
+
+  Serial.println("All tests pass!");
+  return true;
+}
+
+bool all_sweep_benchmarks() {
+  Serial.println("Running benchmarks for \"sweep.h\\cpp\"...");
+
+  ASSERT(bench_sweep(), "Sweep Benchmark Failed");
+
+  Serial.println("All benchmarks pass!");
+  return true;
+}
@@ -0,0 +1,12 @@
+#ifndef SWEEP_TEST_H
+#define SWEEP_TEST_H
+
+#include <Arduino.h>
+#include "sweep.h"
+
+// Needs a recording (and its slopes) in memory, which is more than the ESP8266 has to spare,
+// so unlike the other tests these are only run on a PC.
+bool all_sweep_tests();
+bool all_sweep_benchmarks();
+
+#endif